@@ -4,17 +4,18 @@ import os
 import shutil
 import os.path
 
+# column header and vmstats_dump key of each statistic
 stats = [
-    "TLB Faults",
-    "TLB Faults with Free",
-    "TLB Faults with Replace",
-    "TLB Invalidations",
-    "TLB Reloads",
-    "Page Faults (Zeroed)",
-    "Page Faults (Disk)",
-    "Page Faults from ELF",
-    "Page Faults from Swapfile",
-    "Swapfile Writes"
+    ("TLB Faults", "tlb_faults"),
+    ("TLB Faults with Free", "tlb_faults_free"),
+    ("TLB Faults with Replace", "tlb_faults_replace"),
+    ("TLB Invalidations", "tlb_invalidations"),
+    ("TLB Reloads", "tlb_reloads"),
+    ("Page Faults (Zeroed)", "page_faults_zeroed"),
+    ("Page Faults (Disk)", "page_faults_disk"),
+    ("Page Faults from ELF", "page_faults_elf"),
+    ("Page Faults from Swapfile", "page_faults_swap"),
+    ("Swapfile Writes", "swap_writes")
 ]
 
 programs = [
@@ -37,7 +38,7 @@ tests = [
     "km4"
 ]
 
-def getprompt(proc, prompt):
+def getprompt(proc, prompt, timeout=3600):
 	which = proc.expect_exact([
 			prompt,
 			"panic: ",		# panic message
@@ -46,8 +47,8 @@ def getprompt(proc, prompt):
 			pexpect.EOF,
 			pexpect.TIMEOUT
 		    ],
-            timeout=3600
-        ) #large timeout due to ctest program which takes more time
+            timeout=timeout
+        ) #large default timeout due to ctest program which takes more time
 	if which == 0:
 		# got the prompt
 		return None
@@ -81,17 +82,40 @@ def open_instance():
     return proc
 
 
+def parse_vmstats(output):
+    values = {}
+    inside = False
+    for line in output.split("\n"):
+        line = line.strip()
+        if line == "vmstats begin":
+            inside = True
+        elif line == "vmstats end":
+            break
+        elif inside and "=" in line:
+            key, value = line.split("=", 1)
+            values[key] = value
+    return values
+
+
+def read_vmstats(proc):
+    output = run_cmd(proc, "vms")
+    if output is None:
+        return None
+
+    values = parse_vmstats(output)
+    return [values.get(key, "-") for _, key in stats]
+
+
 def close_instance(proc):
+    results = read_vmstats(proc)
+
     proc.sendline("q")
     msg = getprompt(proc, "The system is halted.")
     if msg:
         return None
 
-    output = proc.before
-    test_result_rows = [o.strip() for o in output.split("\n")][-12:-2]
-
     proc.close()
-    return [r.split(" ")[-1] for r in test_result_rows]
+    return results
 
 def kill_instance(proc):
     proc.close()
@@ -149,7 +173,7 @@ def main():
 
     # Program tests header
     f.write("# Programs\n")
-    f.write("| Program name | Ram size | Execution time | " + " | ".join(stats) + "|\n")
+    f.write("| Program name | Ram size | Execution time | " + " | ".join(name for name, _ in stats) + "|\n")
     f.write("|".join(["-" for _ in range(len(stats) + 3)]) + "\n")
 
     # Program tests
@@ -189,7 +213,7 @@ def main():
 
     # Stability test header
     f.write("# Stability test\n")
-    f.write("|" + " | ".join(stats) + "|\n")
+    f.write("|" + " | ".join(name for name, _ in stats) + "|\n")
     f.write("|" + "|".join(["-" for s in stats]) + "|\n")
 
     # Stability test
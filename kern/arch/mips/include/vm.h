@@ -120,11 +120,11 @@ paddr_t ram_getfirstfree(void);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct addrspace;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	paddr_t ts_paddr;		/* frame whose mapping must be dropped */
+	struct addrspace *ts_as;	/* address space the frame belonged to */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -39,6 +39,7 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <proc.h>
 
 
 /* in exception-*.S */
@@ -149,6 +150,11 @@ mips_trap(struct trapframe *tf)
 						+ STACK_SIZE));
 	}
 
+	if (!iskern) {
+		/* The time since we last left the kernel was user time. */
+		thread_charge(true);
+	}
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
@@ -195,6 +201,20 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+#if OPT_SYSCALLS
+		if (!iskern && curthread->t_curspl == 0) {
+			/*
+			 * Interrupted in user mode: if the process is
+			 * exiting, leave it (see uthread_checkexit)
+			 * with interrupts on, as in a syscall.
+			 */
+			spl = splhigh();
+			splx(spl);
+			uthread_checkexit();
+			cpu_irqoff();
+		}
+#endif
 		goto done2;
 	}
 
@@ -315,6 +335,18 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	if (!iskern) {
+		/*
+		 * Pass the CPU time of the thread on to its process.
+		 * This locks the process, so it must happen while
+		 * interrupts are still on.
+		 */
+		proc_chargetimes(curthread);
+#if OPT_SYSCALLS
+		uthread_checkexit();
+#endif
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
@@ -322,6 +354,11 @@ mips_trap(struct trapframe *tf)
 	cpu_irqoff();
  done2:
 
+	if (!iskern) {
+		/* Leaving the kernel: close the system time interval. */
+		thread_charge(false);
+	}
+
 	/*
 	 * The boot thread can get here (e.g. on interrupt return) but
 	 * since it doesn't go to userlevel, it can't be returning to
@@ -377,6 +414,8 @@ mips_usermode(struct trapframe *tf)
 	spl0();
 	cpu_irqoff();
 
+	thread_charge(false);
+
 	cputhreads[curcpu->c_number] = (vaddr_t)curthread;
 	cpustacks[curcpu->c_number] = (vaddr_t)curthread->t_stack + STACK_SIZE;
 
@@ -436,3 +475,29 @@ enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 	mips_usermode(&tf);
 }
+
+/*
+ * enter_new_thread: go to user mode in a new thread of an existing
+ * process, running ENTRY(ARG) on the stack STACK.
+ *
+ * Works by creating an ersatz trapframe, like enter_new_process.
+ */
+void
+enter_new_thread(userptr_t arg, vaddr_t stack, vaddr_t entry)
+{
+	struct trapframe tf;
+
+	bzero(&tf, sizeof(tf));
+
+	tf.tf_status = CST_IRQMASK | CST_IEp | CST_KUp;
+	tf.tf_epc = entry;
+	tf.tf_a0 = (vaddr_t)arg;
+	/*
+	 * ENTRY is called directly, not through crt0: leave it the
+	 * 16-byte argument save area the MIPS calling convention
+	 * reserves on the caller's stack, where it may spill a0-a3.
+	 */
+	tf.tf_sp = stack - 16;
+
+	mips_usermode(&tf);
+}
@@ -109,28 +109,64 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 	    /* Add stuff here */
 #if OPT_SYSCALLS
+	    case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0,
+				(int)tf->tf_a1,
+				(mode_t)tf->tf_a2,
+				&retval);
+		break;
+	    case SYS_close:
+		err = sys_close((int)tf->tf_a0);
+		break;
 	    case SYS_write:
-	        retval = sys_write((int)tf->tf_a0,
+	        err = sys_write((int)tf->tf_a0,
 				(userptr_t)tf->tf_a1,
-				(size_t)tf->tf_a2);
-		/* error: function not implemented */
-                if (retval<0) err = ENOSYS; 
-		else err = 0;
+				(size_t)tf->tf_a2,
+				&retval);
                 break;
 	    case SYS_read:
-	        retval = sys_read((int)tf->tf_a0,
+	        err = sys_read((int)tf->tf_a0,
 				(userptr_t)tf->tf_a1,
-				(size_t)tf->tf_a2);
-		/* error: function not implemented */
-                if (retval<0) err = ENOSYS; 
-		else err = 0;
+				(size_t)tf->tf_a2,
+				&retval);
                 break;
+	    case SYS_writev:
+	        err = sys_writev((int)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(int)tf->tf_a2,
+				&retval);
+                break;
+	    case SYS_readv:
+	        err = sys_readv((int)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(int)tf->tf_a2,
+				&retval);
+                break;
+	    case SYS_thread_create:
+		err = sys_thread_create((userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				&retval);
+		break;
+	    case SYS_thread_join:
+		err = sys_thread_join((int)tf->tf_a0);
+		break;
+	    case SYS_thread_exit:
+		sys_thread_exit();
+		break;
 	    case SYS__exit:
 	        /* TODO: just avoid crash */
  	        sys__exit((int)tf->tf_a0);
                 break;
+	    case SYS_getrusage:
+		err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
 #endif
 
 	    default:
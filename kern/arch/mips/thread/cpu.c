@@ -229,6 +229,18 @@ cpu_irqoff(void)
         SET_STATUS(x);
 }
 
+/*
+ * Cycle counter: the coprocessor 0 count register.
+ */
+uint32_t
+cpu_cycles(void)
+{
+        uint32_t x;
+
+        __asm volatile("mfc0 %0,$9" : "=r" (x));
+        return x;
+}
+
 /*
  * Used below.
  */
@@ -119,6 +119,16 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Set the timer interrupt of the current CPU to go off in NSECS. (The
+ * next one only: the interrupt handler goes back to HZ.)
+ */
+void
+mainbus_settimer(uint32_t nsecs)
+{
+	mips_timer_set((uint64_t)nsecs * CPU_FREQUENCY / 1000000000);
+}
+
 /*
  * Start all secondary CPUs.
  */
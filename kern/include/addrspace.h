@@ -42,9 +42,17 @@
 #define SEGMENT_TEXT    1
 #define SEGMENT_DATA    2
 #define SEGMENT_STACK   3 
+
+/* how the faults of an address space were resolved, for as_faults */
+#define AS_FAULT_ZERO   0       /* zero-filled page */
+#define AS_FAULT_ELF    1       /* page loaded from the elf file */
+#define AS_FAULT_SWAP   2       /* page read back from the swap file */
+#define AS_FAULT_RELOAD 3       /* resident page, TLB reloaded */
+#define AS_NFAULTS      4
 #endif
 
 struct vnode;
+struct semaphore;
 
 
 /*
@@ -68,6 +76,10 @@ struct addrspace {
         struct segment  *as_data;
         struct segment  *as_stack;
 	struct pt_entry *as_ptable;
+        struct semaphore *as_faultsem;  /* serializes page loads of the threads */
+        unsigned as_faults[AS_NFAULTS]; /* under as_faultsem, except the
+                                           TLB reloads, counted under the
+                                           coremap lock */
 #endif
 };
 
@@ -140,6 +152,7 @@ int               as_define_pt(struct addrspace *as);
 int               as_get_segment_type(struct addrspace *as, vaddr_t vaddr);
 bool              as_check_in_elf(struct addrspace *as, vaddr_t vaddr);
 int               as_load_page(struct addrspace *as,struct vnode *vnode, vaddr_t faultaddress);
+vaddr_t           as_get_stacktop(struct addrspace *as, unsigned slot);
 #endif
 
 /*
@@ -0,0 +1,46 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/*
+ * Kernel microbenchmarks, run from the menu with "bench".
+ *
+ * A benchmark is a function that performs the operation being measured
+ * ITERS times. The framework calls it a few times untimed, to warm up
+ * the caches, the TLB and the allocators' free lists, then BENCH_RUNS
+ * times reading the cycle counter around each call, and prints the
+ * cycles per operation as mean, standard deviation and minimum over
+ * the runs. Any setup the function does is counted too, so it should
+ * be cheap compared to ITERS operations.
+ *
+ * The cycle counter belongs to the cpu, so a benchmark must not make
+ * the calling thread migrate; on sys161 the cpus count in lockstep, so
+ * this only matters for the results on real hardware. The counter is
+ * 32 bits wide: a run that may have taken 2^32 cycles or more (checked
+ * against timer_now) is reported as an error instead.
+ *
+ * The benchmarks run the real kernel code and show up in the kernel's
+ * stats, except tlb_insert, which uses the raw TLB functions: "vms
+ * reset" after benchmarking.
+ */
+
+#define BENCH_WARMUP	2	/* untimed runs */
+#define BENCH_RUNS	10	/* timed runs */
+#define BENCH_ITERS	1000	/* default operations per run */
+
+typedef void (*bench_fn)(unsigned iters);
+
+/*
+ * bench_register - Add a benchmark called NAME. Returns ENOSPC if the
+ *                  table is full, EEXIST if NAME is taken.
+ * bench_run      - Run the benchmark NAME with ITERS operations per
+ *                  run and print the results. Returns ENOENT if there
+ *                  is no such benchmark, ERANGE if a run was too long
+ *                  for the cycle counter.
+ */
+int bench_register(const char *name, bench_fn fn);
+int bench_run(const char *name, unsigned iters);
+
+/* Register the built-in benchmarks (test/benchmarks.c). */
+void benchmarks_register(void);
+
+#endif /* _BENCH_H_ */
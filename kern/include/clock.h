@@ -38,8 +38,8 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second when the CPU is
+ * not idle, for scheduling, and also whenever a timer of the CPU is due.
  */
 
 /* hardclocks per second */
@@ -48,6 +48,13 @@
 void hardclock_bootstrap(void);
 void hardclock(void);
 
+/*
+ * Reprogram the timer interrupt of this cpu after its plans changed:
+ * a new timer is due before the interrupt, or the cpu stopped idling
+ * and needs its hardclock back.
+ */
+void clock_program(void);
+
 /*
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
@@ -79,5 +86,11 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * Sleep for a number of nanoseconds, with the precision of the
+ * timer interrupt rather than of hardclock.
+ */
+void timer_sleep(uint64_t nsecs);
+
 
 #endif /* _CLOCK_H_ */
@@ -59,6 +59,13 @@
  * The const qualifiers and types will help protect against mistakes
  * in this regard but are obviously not foolproof.
  *
+ * copyinv/copyoutv are vectored versions of copyin/copyout: they
+ * check all NVEC regions of the array VEC first, and then copy all of
+ * them within a single fault-protected section. They are meant for
+ * system calls that move several small user structures at once. If
+ * any region is invalid nothing is copied and EFAULT is returned; a
+ * fault in the middle of the copy may leave earlier regions copied.
+ *
  * These functions are machine-dependent; however, a common version
  * that can be used by a number of machine types is found in
  * vm/copyinout.c.
@@ -69,5 +76,17 @@ int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
+/*
+ * One region for copyinv/copyoutv.
+ */
+struct copyvec {
+	void *cv_kbase;			/* kernel address */
+	userptr_t cv_ubase;		/* user-level address */
+	size_t cv_len;			/* length of the region */
+};
+
+int copyinv(const struct copyvec *vec, unsigned nvec);
+int copyoutv(const struct copyvec *vec, unsigned nvec);
+
 
 #endif /* _COPYINOUT_H_ */
@@ -10,14 +10,34 @@ struct coremap_entry
 {
     unsigned char       cm_used : 1;
     unsigned long       cm_allocsize : 20;      
-    unsigned char       cm_lock : 1;
+    unsigned char       cm_lock : 1;            /*  taken by an eviction batch          */
+    unsigned char       cm_evicting : 1;        /*  being swapped out, do not map it    */
+    unsigned char       cm_orphan : 1;          /*  owner gone during the eviction: the
+                                                    evictor drops the page when done    */
+    unsigned char       cm_pins;                /*  pin count, not evictable while > 0  */
     struct pt_entry     *cm_ptentry;            /*  page table entry of the page living 
                                                     in this frame, NULL if kernel page  */
+    struct addrspace    *cm_as;                 /*  address space of the page, NULL if
+                                                    kernel page                         */
 };
 
 void        coremap_bootstrap(void);
-paddr_t     coremap_getppages(int npages, struct pt_entry *ptentry);
+paddr_t     coremap_getppages(int npages, struct pt_entry *ptentry, struct addrspace *as);
 void        coremap_freeppages(paddr_t addr);
+void        coremap_release_page(struct pt_entry *ptentry);
+bool        coremap_pin_frame(struct pt_entry *ptentry);
+void        coremap_unpin_frame(paddr_t addr);
+bool        coremap_tlb_reload(struct pt_entry *ptentry, vaddr_t vaddr, bool readonly,
+                               unsigned *count);
+unsigned    coremap_occupancy(char *map, unsigned len);
+
+/* frame states in the map of coremap_occupancy */
+#define COREMAP_FREE    '.'
+#define COREMAP_KERNEL  'K'
+#define COREMAP_USER    'U'
+#define COREMAP_LOCKED  'L'     /* user page pinned or being evicted */
+
+#define COREMAP_MAXPINS 255
 
 #endif /* OPT_RUDEVM */
 
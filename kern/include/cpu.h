@@ -59,8 +59,24 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Destroyed threads, for reuse */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	uint64_t c_nexttick;		/* When the next hardclock is due (ns) */
+	uint64_t c_nextevent;		/* When the timer interrupt is set for */
+	uint32_t c_cyclelast;		/* Cycle counter at the last timer_cpu_now */
+	uint32_t c_cyclerem;		/* Part of a ns left over, in 1e-6 cycles */
+	uint64_t c_cpuns;		/* What timer_cpu_now returned then */
+
+	/*
+	 * Where the time of this cpu went, in nanoseconds (see
+	 * thread_charge). Read by other cpus without locking, as
+	 * statistics.
+	 */
+	uint64_t c_utime;		/* Running user code */
+	uint64_t c_stime;		/* Running kernel code */
+	uint64_t c_schedtime;		/* In thread_switch */
+	uint64_t c_idletime;		/* Idle */
 
 	/*
 	 * Accessed by other cpus.
@@ -70,6 +86,19 @@ struct cpu {
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Number of threads in c_runqueue. Only written with the
+	 * runqueue lock held, but read without it by idle cpus looking
+	 * for work to steal: it's only a hint.
+	 */
+	volatile unsigned c_nready;
+
+	/*
+	 * Accessed by other cpus (to cancel timers).
+	 * Has its own lock.
+	 */
+	struct timerwheel *c_timers;	/* One-shot timers (see timer.h) */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -82,10 +111,21 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * When more than TLBSHOOTDOWN_MAX requests pile up they are
+	 * coalesced by setting c_shootdown_all, which flushes the
+	 * whole TLB. c_shootdown_gen is incremented every time the
+	 * queued requests have been carried out, so that a requester
+	 * can wait for them. c_tlb_as is the address space whose
+	 * mappings may currently be in the TLB (set by as_activate);
+	 * it is only used to pick the targets of a shootdown.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	bool c_shootdown_all;
+	unsigned c_shootdown_gen;
+	struct addrspace *c_tlb_as;
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -112,6 +152,11 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Number of CPUs in the system.
+ */
+unsigned cpu_count(void);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -125,6 +170,13 @@ void cpu_identify(char *buf, size_t max);
 void cpu_irqoff(void);
 void cpu_irqon(void);
 
+/*
+ * Read the processor's cycle counter. It is 32 bits wide and wraps
+ * around, so it is only good for measuring short intervals, and only
+ * on one cpu.
+ */
+uint32_t cpu_cycles(void);
+
 /*
  * Idle or shut down (respectively) the processor.
  *
@@ -156,6 +208,12 @@ void cpu_halt(void);
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
  *
+ * ipi_tlbshootdown_sync carries out a batch of TLB shootdowns on the
+ * current CPU and sends each one to the other CPUs whose TLB may hold
+ * it (per c_tlb_as; all of them for a NULL ts_as, meaning a kernel
+ * mapping), and waits until all of them have been carried out. It
+ * must be called without holding spinlocks.
+ *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
  */
@@ -169,6 +227,7 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_sync(const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,36 @@
+#ifndef _KHEAPPROF_H_
+#define _KHEAPPROF_H_
+
+/*
+ * Kernel heap profiler.
+ *
+ * While it is on, every kmalloc is recorded against its call site
+ * (the return address of kmalloc), and the report shows, per call
+ * site, the bytes and blocks still allocated, the total number of
+ * allocations, and the allocation rate since the last report. Blocks
+ * allocated while the profiler was off are not counted when freed.
+ *
+ * Note that the call site of everything allocated by kstrdup and the
+ * like is the helper, not its caller.
+ *
+ * kheapprof_start   - Turn it on. Returns ENOMEM if it can't get the
+ *                     memory to keep track of the blocks.
+ * kheapprof_stop    - Turn it off; the statistics are kept.
+ * kheapprof_reset   - Clear the statistics.
+ * kheapprof_print   - Print the N call sites with the most live bytes.
+ *
+ * kheapprof_alloc and kheapprof_free are called by kmalloc and kfree
+ * when kheapprof_on is set.
+ */
+
+extern volatile bool kheapprof_on;
+
+int kheapprof_start(void);
+void kheapprof_stop(void);
+void kheapprof_reset(void);
+void kheapprof_print(unsigned n);
+
+void kheapprof_alloc(void *ptr, size_t size, vaddr_t site);
+void kheapprof_free(void *ptr);
+
+#endif /* _KHEAPPROF_H_ */
@@ -0,0 +1,88 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A cache hands out objects of one fixed size, packed exactly into
+ * whole pages (slabs) instead of being rounded up to one of kmalloc's
+ * sizes. Objects are built by the constructor when their slab is made
+ * and go back to the cache still constructed: kmem_cache_alloc gives
+ * out an object in the state the constructor left it in, or in which
+ * it was last freed, and the caller must free it in that same state.
+ * The destructor undoes the constructor when a slab is given back.
+ * Either may be NULL. A constructor returns 0 or an error code.
+ *
+ * Caches that are needed before kmalloc works, or that just live
+ * forever, can be static and set up with KMEM_CACHE_INITIALIZER.
+ *
+ * Like kmalloc, each cache has a small magazine of free objects per
+ * cpu, used with interrupts off and without kc_lock: an object freed
+ * on a cpu is handed out again by that cpu, so a cpu that creates and
+ * destroys semaphores or wchans stays off the shared lock.
+ *
+ * Objects may be at most KMEM_MAXSIZE bytes.
+ */
+
+#include <spinlock.h>
+
+struct kmem_slab;	/* Opaque. */
+
+#define KMEM_MAXCPUS 32
+#define KMEM_MAGSIZE 8
+
+struct kmem_mag {
+	unsigned km_count;
+	void *km_objs[KMEM_MAGSIZE];
+	uint64_t km_allocs;		/* allocations served from here */
+};
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size asked for */
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_slabs;	/* slabs with free objects */
+	size_t kc_objsize;		/* aligned size */
+	unsigned kc_perslab;		/* objects per slab, 0 if not known yet */
+	unsigned kc_nslabs;		/* slabs */
+	unsigned kc_nempty;		/* ... with nothing in use */
+	unsigned kc_inuse;		/* objects handed out */
+	unsigned kc_ctors;		/* constructor calls */
+	uint64_t kc_allocs;		/* kmem_cache_alloc calls */
+	bool kc_listed;			/* on the list of all caches yet? */
+	struct kmem_cache *kc_next;	/* list of all caches */
+	struct kmem_mag kc_mags[KMEM_MAXCPUS];	/* per cpu, no lock */
+};
+
+#define KMEM_MAXSIZE (PAGE_SIZE / 4)
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ name, size, ctor, dtor, SPINLOCK_INITIALIZER, NULL, \
+	  0, 0, 0, 0, 0, 0, 0, false, NULL, { { 0, { NULL }, 0 } } }
+
+/*
+ * Operations:
+ *    kmem_cache_create  - Make a cache of SIZE byte objects. NAME is
+ *                         used in the statistics and should be a
+ *                         string constant. Returns NULL if out of
+ *                         memory.
+ *    kmem_cache_destroy - Give all of a cache back. All its objects
+ *                         must have been freed. Not for static caches.
+ *    kmem_cache_alloc   - Get an object. Returns NULL if out of memory.
+ *    kmem_cache_free    - Give an object back to its cache.
+ *
+ *    kmem_cache_printstats - Print the usage of all caches; called by
+ *                            kheap_printstats.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
@@ -0,0 +1,82 @@
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiler. Enable with "options lockprof" in the
+ * kernel config.
+ *
+ * A lock is profiled by attaching a struct lockprof to it; its
+ * counters are updated by each thread that gets the lock, while it
+ * holds it, so they are protected by the lock itself. Spinlock waits
+ * are timed with the cycle counter, as they happen on one cpu with
+ * interrupts off; sleep lock waits in nanoseconds. Call sites are
+ * return addresses: look them up in the kernel with addr2line.
+ */
+
+#include "opt-lockprof.h"
+
+struct spinlock;
+struct lock;
+
+#if OPT_LOCKPROF
+
+struct lockprof {
+	const char *lp_name;
+	bool lp_sleeplock;		/* times are ns, not cycles */
+	struct lockprof *lp_next;	/* list of all profiles */
+	uint64_t lp_acquires;		/* acquisitions */
+	uint64_t lp_contended;		/* ... that had to wait */
+	uint64_t lp_waittime;		/* total time waited */
+	uint64_t lp_maxwait;		/* longest wait */
+	vaddr_t lp_holder;		/* where the last holder got the lock */
+	vaddr_t lp_maxwaiter;		/* who waited the longest */
+	vaddr_t lp_maxblocker;		/* ... for whom */
+};
+
+struct lockprof *lockprof_create(const char *name);
+void lockprof_attach_spinlock(struct spinlock *lk, struct lockprof *lp);
+void lockprof_attach_lock(struct lock *lk, struct lockprof *lp);
+void lockprof_acquired(struct lockprof *lp, uint64_t wait, bool waited,
+		       vaddr_t site);
+void lockprof_print(void);
+void lockprof_reset(void);
+
+#define LOCKPROF_FIELD(sym)		struct lockprof *sym
+#define LOCKPROF_FIELD_INITIALIZER	NULL,
+#define LOCKPROF_FIELDINIT(p)		(*(p) = NULL)
+
+#define LOCKPROF_SPINLOCK(lk, name) \
+	lockprof_attach_spinlock(lk, lockprof_create(name))
+#define LOCKPROF_LOCK(lk, name) \
+	lockprof_attach_lock(lk, lockprof_create(name))
+
+/*
+ * Clocks for spinlock and sleep lock waits. The sleep lock one is only
+ * read for profiled locks, as unprofiled ones may be used before
+ * there is a clock.
+ */
+#define LOCKPROF_CYCLES()		cpu_cycles()
+#define LOCKPROF_NSECS(lp)		((lp) != NULL ? timer_now() : 0)
+
+/* Must be used directly in spinlock_acquire or lock_acquire. */
+#define LOCKPROF_ACQUIRED(lp, wait, waited) \
+	((lp) != NULL ? lockprof_acquired(lp, wait, waited, \
+			(vaddr_t)__builtin_return_address(0)) : (void)0)
+
+#else
+
+#define LOCKPROF_FIELD(sym)
+#define LOCKPROF_FIELD_INITIALIZER
+#define LOCKPROF_FIELDINIT(p)
+
+#define LOCKPROF_SPINLOCK(lk, name)
+#define LOCKPROF_LOCK(lk, name)
+
+#define LOCKPROF_CYCLES()		0
+#define LOCKPROF_NSECS(lp)		0
+
+#define LOCKPROF_ACQUIRED(lp, wait, waited) ((void)(wait), (void)(waited))
+
+#endif
+
+#endif /* _LOCKPROF_H_ */
@@ -40,10 +40,30 @@
 #include <pt.h>
 #include "opt-rudevm.h"
 #include "opt-waitpid.h"
+#include "opt-syscalls.h"
+#include <limits.h>
 
 struct addrspace;
 struct thread;
 struct vnode;
+struct semaphore;
+
+/*
+ * Maximum number of user threads of a process, the main one included.
+ * Each of them gets its own stack region in the address space.
+ */
+#define UTHREAD_MAX 8
+
+#if OPT_SYSCALLS
+/*
+ * User thread slot, as seen by thread_create/thread_join.
+ */
+struct uthread {
+	bool ut_used;			/* slot taken by a live or unjoined thread */
+	bool ut_joining;		/* someone is already waiting for it */
+	struct semaphore *ut_done;	/* signalled when the thread exits */
+};
+#endif
 
 /*
  * Process structure.
@@ -73,11 +93,29 @@ struct proc {
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
+	/*
+	 * CPU time in nanoseconds, protected by p_lock: of the threads
+	 * of the process (see proc_chargetimes), and of its children
+	 * that have been waited for.
+	 */
+	uint64_t p_utime;
+	uint64_t p_stime;
+	uint64_t p_cutime;
+	uint64_t p_cstime;
+	struct proc *p_allnext;		/* list of all processes, for ps */
+
 	/* add more material here as needed */
 #if OPT_RUDEVM
 	struct vnode *p_vnode;		/* process ELF vnode */
 #endif
 
+#if OPT_SYSCALLS
+	struct spinlock p_filelock;		/* for p_filetable and of_refcount */
+	struct openfile *p_filetable[OPEN_MAX];	/* open files, NULL if free */
+	struct uthread p_uthreads[UTHREAD_MAX];	/* user threads, protected by p_lock */
+	bool p_exiting;			/* _exit called, under p_lock */
+#endif
+
 #if OPT_WAITPID
 	int status;  			/*	exit status of the process	*/
 	struct semaphore *p_sem;
@@ -99,8 +137,17 @@ void proc_destroy(struct proc *proc);
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
-/* Detach a thread from its process. */
-void proc_remthread(struct thread *t);
+/* Detach a thread from its process. Returns true if it was the last. */
+bool proc_remthread(struct thread *t);
+
+/* Add the CPU time a thread used since the last call to its process. */
+void proc_chargetimes(struct thread *t);
+
+/* Print the CPU time of all processes. */
+void proc_printtimes(void);
+
+/* Call FUNC(proc, DATA) for each process, with the process list locked. */
+void proc_foreach(void (*func)(struct proc *, void *), void *data);
 
 /* Fetch the address space of the current process. */
 struct addrspace *proc_getas(void);
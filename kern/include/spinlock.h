@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include <lockprof.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -54,27 +55,53 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * A spinlock is either a test-and-set lock, where all the waiting
+ * cpus spin on splk_lock and whichever gets there first wins, or a
+ * ticket lock: a waiting cpu takes a ticket from splk_next and waits
+ * for splk_lock (the ticket being served) to get to it, so the lock
+ * goes to the waiters in order. Ticket locks are fair and, as each
+ * waiter backs off according to its place in line, cause less bus
+ * traffic under contention; test-and-set locks are a bit cheaper when
+ * there is none. Both kinds are used the same way.
  */
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
+	volatile spinlock_data_t splk_next; /* Next ticket (ticket lock). */
+	bool splk_ticket;		    /* Is it a ticket lock? */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	LOCKPROF_FIELD(splk_prof);	    /* Contention profile. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
 #ifdef OPT_HANGMAN
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, false, NULL, \
+				  LOCKPROF_FIELD_INITIALIZER \
+				  HANGMAN_LOCKABLE_INITIALIZER }
+#define SPINLOCK_TICKET_INITIALIZER \
+				{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, true, NULL, \
+				  LOCKPROF_FIELD_INITIALIZER \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, false, NULL, \
+				  LOCKPROF_FIELD_INITIALIZER }
+#define SPINLOCK_TICKET_INITIALIZER \
+				{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, true, NULL, \
+				  LOCKPROF_FIELD_INITIALIZER }
 #endif
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, for a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -84,6 +111,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
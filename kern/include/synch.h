@@ -58,9 +58,13 @@ void sem_destroy(struct semaphore *);
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * P_timed is P that gives up after NSECS nanoseconds; it returns false
+ * (without decrementing) if it timed out.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+bool P_timed(struct semaphore *, uint64_t nsecs);
 
 
 /*
@@ -75,10 +79,19 @@ void V(struct semaphore *);
 struct lock {
         char *lk_name;
         HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *lk_wchan;
+	struct spinlock lk_lock;	/* protects lk_holder and lk_wchan */
+	struct thread *volatile lk_holder;
+	unsigned lk_nsleeps;		/* times a waiter went to sleep */
+	LOCKPROF_FIELD(lk_prof);	/* contention profile */
 };
 
+/*
+ * How many times lock_acquire polls a lock whose holder is running on
+ * another CPU before giving up and going to sleep.
+ */
+#define LOCK_SPIN_MAX 500
+
 struct lock *lock_create(const char *name);
 void lock_destroy(struct lock *);
 
@@ -91,7 +104,8 @@ void lock_destroy(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
- * These operations must be atomic. You get to write them.
+ * These operations are atomic. A thread waiting for a lock spins for a
+ * while if the holder is running on another CPU, and sleeps otherwise.
  */
 void lock_acquire(struct lock *);
 void lock_release(struct lock *);
@@ -114,8 +128,8 @@ bool lock_do_i_hold(struct lock *);
 
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct wchan *cv_wchan;
+	struct spinlock cv_lock;	/* protects cv_wchan */
 };
 
 struct cv *cv_create(const char *name);
@@ -132,11 +146,69 @@ void cv_destroy(struct cv *);
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
- * These operations must be atomic. You get to write them.
+ * cv_broadcast does not wake the waiters: it moves them to the queue of
+ * the lock, so that they are woken one at a time as the lock becomes
+ * free instead of all fighting for it at once.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers or a single writer can hold the lock. Writers
+ * have priority: once a writer is waiting, new readers wait until
+ * there are no more writers around, so writers cannot starve.
+ *
+ * Readers are counted per CPU, so that readers on different CPUs do
+ * not fight over the same counter. A reader may release the lock on a
+ * different CPU than it acquired it on, so the counters can go below
+ * zero: only their sum is meaningful.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+#define RWLOCK_MAXCPUS 32
+#define RWLOCK_LINESIZE 64	/* cache line size, or a multiple of it */
+
+/*
+ * Each per-CPU entry has a cache line of its own, or the CPUs would
+ * still share lines. This makes struct rwlock larger than the biggest
+ * kmalloc size class, so it gets whole pages, which are aligned.
+ */
+struct rwlock_cpu {
+	struct spinlock rc_lock;	/* protects rc_readers */
+	volatile int rc_readers;
+} __ALIGNED(RWLOCK_LINESIZE);
+
+struct rwlock {
+	char *rw_name;
+	struct spinlock rw_lock;	/* protects the rest */
+	struct wchan *rw_rwchan;	/* readers waiting */
+	struct wchan *rw_wwchan;	/* writers waiting */
+	struct thread *volatile rw_writer;
+	volatile unsigned rw_wwaiting;
+	struct rwlock_cpu rw_cpus[RWLOCK_MAXCPUS];
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Multiple threads
+ *                          can hold the lock for reading at the same time.
+ *    rwlock_release_read  - Free the lock.
+ *    rwlock_acquire_write - Get the lock for writing. Only one thread can
+ *                          hold the write lock at one time.
+ *    rwlock_release_write - Free the write lock.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
@@ -53,6 +53,10 @@ void enter_forked_process(struct trapframe *tf);
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
 
+/* Enter user mode in a new thread of the current process. */
+__DEAD void enter_new_thread(userptr_t arg, vaddr_t stackptr,
+		       vaddr_t entrypoint);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -60,11 +64,43 @@ __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(userptr_t req, userptr_t rem);
 
 #if OPT_SYSCALLS
-int sys_write(int fd, userptr_t buf_ptr, size_t size);
-int sys_read(int fd, userptr_t buf_ptr, size_t size);
+struct vnode;
+struct lock;
+struct proc;
+
+/*
+ * File opened by a process.
+ */
+struct openfile {
+	struct vnode *of_vnode;		/* file */
+	off_t of_offset;		/* current seek position */
+	int of_flags;			/* flags given to open */
+	struct lock *of_lock;		/* serializes I/O on of_offset */
+	unsigned of_refcount;		/* table slot and I/O in progress,
+					   under the owner's p_filelock */
+};
+
+int sys_open(userptr_t path, int openflags, mode_t mode, int32_t *retval);
+int sys_close(int fd);
+int sys_write(int fd, userptr_t buf_ptr, size_t size, int32_t *retval);
+int sys_read(int fd, userptr_t buf_ptr, size_t size, int32_t *retval);
+int sys_writev(int fd, userptr_t iov_ptr, int iovcnt, int32_t *retval);
+int sys_readv(int fd, userptr_t iov_ptr, int iovcnt, int32_t *retval);
 void sys__exit(int status);
+int sys_getrusage(int who, userptr_t usage);
+
+void file_closeall(struct proc *p);
+
+int sys_thread_create(userptr_t func, userptr_t arg, int32_t *retval);
+int sys_thread_join(int tid);
+__DEAD void sys_thread_exit(void);
+
+__DEAD void uthread_leave(void);
+void uthread_checkexit(void);
+void uthread_destroyall(struct proc *p);
 #endif
 
 #endif /* _SYSCALL_H_ */
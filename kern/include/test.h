@@ -50,10 +50,17 @@ int threadlisttest(int, char **);
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
+int threadtest5(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
+int lockbench(int, char **);
+int cvbench(int, char **);
+int rwtest(int, char **);
+int spinlocktest(int, char **);
+int timertest(int, char **);
 
 /* semaphore unit tests */
 int semu1(int, char **);
@@ -94,6 +101,7 @@ int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int nettest(int, char **);
+int benchmark(int, char **);
 
 /* Routine for running a user-level program. */
 int runprogram(char *progname);
@@ -72,6 +72,7 @@ struct thread {
 	 */
 	char *t_name;			/* Name of this thread */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
+	struct wchan *t_wchan;		/* Wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
 	/*
@@ -85,6 +86,25 @@ struct thread {
 	struct proc *t_proc;		/* Process thread belongs to */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduling fields (see schedule()). Protected by the run
+	 * queue lock of t_cpu, or only touched by the thread itself.
+	 */
+	unsigned t_priority;		/* Feedback level, 0 = highest */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+
+	/*
+	 * CPU time accounting, in nanoseconds (see thread_charge).
+	 * Only touched by the thread itself, with interrupts off; the
+	 * totals are added to t_proc from time to time, and
+	 * t_ucharged/t_scharged record how much of them already was.
+	 */
+	uint64_t t_mark;		/* Start of the current interval */
+	uint64_t t_utime;		/* Time spent in user mode */
+	uint64_t t_stime;		/* Time spent in the kernel */
+	uint64_t t_ucharged;		/* Part of t_utime given to t_proc */
+	uint64_t t_scharged;		/* Part of t_stime given to t_proc */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -107,6 +127,7 @@ struct thread {
 	 */
 
 	/* add more here as needed */
+	unsigned t_uslot;		/* User thread slot in t_proc (0 = main) */
 };
 
 /*
@@ -159,15 +180,24 @@ __DEAD void thread_exit(void);
 void thread_yield(void);
 
 /*
- * Reshuffle the run queue. Called from the timer interrupt.
+ * Charge the current hardclock tick to the running thread and
+ * preempt it if its time slice is over or a more important thread
+ * is waiting. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the time since the last call to the current thread and cpu,
+ * as user time if USER is true or else as system time, and return
+ * the current time. Called with interrupts off whenever the thread
+ * enters or leaves user mode.
+ */
+uint64_t thread_charge(bool user);
+
+/*
+ * Print the user, system, scheduler and idle time of each cpu.
  */
-void thread_consider_migration(void);
+void cpu_printtimes(void);
 
 
 #endif /* _THREAD_H_ */
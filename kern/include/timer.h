@@ -0,0 +1,70 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * One-shot kernel timers.
+ *
+ * A timer calls tm_func(tm_data) once the time given to timer_add has
+ * passed. Times are in nanoseconds on the timer_now() clock. The
+ * function runs in the timer interrupt of the CPU the timer was added
+ * on, so it must not sleep.
+ *
+ * Timers are kept on a per-CPU hierarchical timer wheel: level 0 has
+ * one slot per 2^TW_SHIFT ns (about a millisecond), level 1 one slot
+ * per whole turn of level 0, and timers even further away wait on a
+ * list of their own. Adding and cancelling a timer is O(1); timers are
+ * moved down a level as their time gets closer.
+ */
+
+#include <spinlock.h>
+
+struct timerwheel;
+
+struct timer {
+	struct timer *tm_next;
+	struct timer **tm_pprev;	/* NULL if not pending */
+	struct timerwheel *tm_wheel;	/* where it was added */
+	uint64_t tm_expires;
+	void (*tm_func)(void *);
+	void *tm_data;
+};
+
+#define TIMER_NEVER	((uint64_t)-1)
+
+/* Current time, in nanoseconds. */
+uint64_t timer_now(void);
+
+/*
+ * CPU time of the current cpu, in nanoseconds, from its cycle counter.
+ * This is much cheaper than timer_now(), which reads the real-time
+ * clock over the bus, but each cpu counts on its own: only the
+ * difference of two readings taken on the same cpu means anything.
+ * Call with interrupts off. It reads 0 until timer_bootstrap has
+ * measured how fast the counter runs.
+ */
+void timer_bootstrap(void);
+uint64_t timer_cpu_now(void);
+
+/*
+ * Operations:
+ *    timer_init   - Set up a timer that will call FUNC(DATA).
+ *    timer_add    - Arm the timer to go off at time EXPIRES. The timer
+ *                   must not be pending already.
+ *    timer_cancel - Disarm the timer. Returns false if it was not
+ *                   pending, i.e. if its function has already been
+ *                   called or is about to be.
+ */
+void timer_init(struct timer *t, void (*func)(void *), void *data);
+void timer_add(struct timer *t, uint64_t expires);
+bool timer_cancel(struct timer *t);
+
+/*
+ * For the clock code: create the wheel of a CPU, run the expired
+ * timers of the current CPU's wheel, and get the time the next one
+ * expires (at the latest; TIMER_NEVER if there are none).
+ */
+struct timerwheel *timerwheel_create(void);
+void timerwheel_run(uint64_t now);
+uint64_t timerwheel_next(void);
+
+#endif /* _TIMER_H_ */
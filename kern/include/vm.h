@@ -61,9 +61,14 @@ void    free_kpages(vaddr_t addr);
 /* Allocate/free user pages */
 void    free_upage(paddr_t addr);
 paddr_t alloc_upage(struct pt_entry *pt_row);
+
+/* Fault in and pin/unpin a user page for in-kernel I/O */
+int     vm_pin_upage(struct addrspace *as, vaddr_t vaddr, bool towrite, paddr_t *ret);
+void    vm_unpin_upage(paddr_t paddr);
 #endif
 
 /* TLB shootdown handling called from interprocessor_interrupt */
 void    vm_tlbshootdown(const struct tlbshootdown *);
+void    vm_tlbshootdown_all(void);
 
 #endif /* _VM_H_ */
@@ -11,11 +11,21 @@
  *
  *  tlb_insert: associate a vaddress to a paddress in the tlb.
  *      Set ro to true to insert as read-only.
+ *
+ *  tlb_insert_kernel: same for a kernel (kseg2) mapping, writable; it
+ *      is not counted in the vmstats, which are about user faults.
+ *
+ *  tlb_insert_raw, tlb_invalidate_raw: tlb_insert and tlb_invalidate
+ *      without the vmstats and the trace, for the benchmarks, which
+ *      measure the TLB writes themselves.
  * 
  *  tlb_remove: remove a virtual address from the TLB if is present.
  */
 void tlb_invalidate(void);
 void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro);
+void tlb_insert_kernel(vaddr_t vaddr, paddr_t paddr);
+void tlb_insert_raw(vaddr_t vaddr, paddr_t paddr, bool ro);
+void tlb_invalidate_raw(void);
 void tlb_remove_by_vaddr(vaddr_t vaddr);
 void tlb_remove_by_paddr(paddr_t paddr);
 
@@ -0,0 +1,43 @@
+#ifndef _VMALLOC_H_
+#define _VMALLOC_H_
+
+#include <types.h>
+#include <vm.h>
+#include "opt-rudevm.h"
+
+#if OPT_RUDEVM
+
+/*
+ * Kernel virtual memory allocator.
+ *
+ * vmalloc gives out kernel memory that is contiguous in kseg2, which
+ * is mapped through the TLB, but made of frames from anywhere in RAM.
+ * Use it for big allocations that don't need to be physically
+ * contiguous, so that they keep working when RAM is fragmented.
+ *
+ * The memory must not be used for things that may be touched while
+ * taking an exception, like thread stacks: it is mapped into the TLB
+ * on demand, by vm_fault.
+ *
+ *  vmalloc: allocate SIZE bytes, rounded up to whole pages. Returns
+ *      NULL if out of memory or kernel address space. May sleep.
+ *
+ *  vfree: free memory from vmalloc. May sleep, and must not be called
+ *      with spinlocks held.
+ *
+ *  vmalloc_fault: map a vmalloc address in the TLB, for vm_fault.
+ */
+
+#define VMALLOC_BASE	MIPS_KSEG2
+#define VMALLOC_NPAGES	4096		/* 16M: as much as RAM can be */
+#define VMALLOC_TOP	(VMALLOC_BASE + VMALLOC_NPAGES * PAGE_SIZE)
+
+#define VMALLOC_ADDR(va) ((va) >= VMALLOC_BASE && (va) < VMALLOC_TOP)
+
+void    *vmalloc(size_t size);
+void    vfree(void *ptr);
+int     vmalloc_fault(int faulttype, vaddr_t faultaddress);
+
+#endif /* OPT_RUDEVM */
+
+#endif /* _VMALLOC_H_ */
@@ -0,0 +1,21 @@
+#ifndef _VMINFO_H_
+#define _VMINFO_H_
+
+/*
+ * VM introspection: for each process, its segments, the state of
+ * their pages and how its faults were resolved; then a map of the
+ * frames of the coremap. Printed by the "vm" menu command, and read
+ * from the "vminfo:" device while processes run, e.g. with
+ * "cat vminfo:".
+ */
+
+#include "opt-rudevm.h"
+
+#if OPT_RUDEVM
+
+void vminfo_bootstrap(void);
+void vminfo_print(void);
+
+#endif /* OPT_RUDEVM */
+
+#endif /* _VMINFO_H_ */
@@ -11,8 +11,31 @@
 #define VMSTAT_PAGE_FAULT_ELF 7
 #define VMSTAT_PAGE_FAULT_SWAP 8
 #define VMSTAT_SWAP_WRITE 9
+#define VMSTAT_COUNT 10
 
+/* kinds of fault whose latency is measured */
+#define VMLAT_ZERO 0        /* fault on a zero-filled page */
+#define VMLAT_ELF 1         /* fault on a page loaded from the elf file */
+#define VMLAT_SWAPIN 2      /* fault on a page in the swap file */
+#define VMLAT_EVICT 3       /* eviction to make room for an allocation */
+#define VMLAT_COUNT 4
+
+/**
+ * The counters are kept per cpu and only added up when read, so
+ * vmstats_hit takes no lock. vmstats_dump prints them one per line as
+ * key=value between "vmstats begin" and "vmstats end", for scripts;
+ * vmstats_print prints them for people.
+ *
+ * vmstats_latency records how long (in ns) an event of a VMLAT_ kind
+ * took, in a log2 histogram; the print and the dump show the count,
+ * mean, p50, p99 and max of each kind.
+ */
+void vmstats_bootstrap(void);
 void vmstats_hit(unsigned int stat);
+void vmstats_latency(unsigned int kind, uint64_t ns);
+uint64_t vmstats_get(unsigned int stat);
+void vmstats_reset(void);
 void vmstats_print(void);
+void vmstats_dump(void);
 
-#endif
\ No newline at end of file
+#endif
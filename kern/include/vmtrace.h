@@ -0,0 +1,94 @@
+#ifndef _VMTRACE_H_
+#define _VMTRACE_H_
+
+/*
+ * VM event trace. Enable with "options vmtrace" in the kernel config,
+ * then turn it on from the menu ("vmtrace on").
+ *
+ * Each cpu records its VM events in a ring of its own, with interrupts
+ * off and without locks; when a ring is full the oldest events are
+ * overwritten. "vmtrace save" writes the rings to a file (normally on
+ * emu0:, i.e. on the host), which vmtrace_decode.py turns into a
+ * timeline and a working-set curve. With "vmtrace on ltrace" each
+ * event is also sent to trace161 with ltrace_debug, as
+ * (type << 24) | (page number of A & 0xffffff).
+ *
+ * The file is big-endian: a struct vmtrace_header, then for each cpu
+ * a uint32_t count followed by that many struct vmtrace_event, oldest
+ * first.
+ */
+
+#include "opt-vmtrace.h"
+
+struct addrspace;
+
+/* event types, and what A, B and AUX are for each */
+#define VMT_FAULT	1	/* A = address, AUX = VM_FAULT_* */
+#define VMT_RESOLVE	2	/* A = page, B = frame paddr, AUX = VMT_PATH_* */
+#define VMT_SWAPIN	3	/* A = swap slot, B = frame paddr */
+#define VMT_EVICT	4	/* A = frame paddr, B = swap slot, AUX = VMT_EVICT_* */
+#define VMT_TLB		5	/* A = page, B = frame paddr, AUX = TLB slot,
+				   | VMT_TLB_REPLACED if it held a mapping */
+#define VMT_TLBFLUSH	6	/* whole TLB invalidated */
+
+/* how a fault was resolved */
+#define VMT_PATH_ZERO	0	/* zero-filled page */
+#define VMT_PATH_ELF	1	/* loaded from the elf file */
+#define VMT_PATH_SWAP	2	/* read back from the swap file */
+#define VMT_PATH_RELOAD	3	/* page was resident, TLB reloaded */
+#define VMT_PATH_RETRY	4	/* page being evicted, fault again later */
+
+/* what happened to an evicted page */
+#define VMT_EVICT_SWAPPED 0	/* written to the swap file */
+#define VMT_EVICT_DROPPED 1	/* read-only, will be reloaded from the elf */
+
+#define VMT_TLB_REPLACED 0x80
+
+struct vmtrace_event {
+	uint64_t ve_time;		/* ns, on the timer_now() clock */
+	uint32_t ve_a;
+	uint32_t ve_b;
+	uint32_t ve_as;			/* address space, 0 if none/unknown */
+	uint8_t ve_type;
+	uint8_t ve_aux;
+	uint8_t ve_cpu;
+	uint8_t ve_pad;
+};
+
+#define VMTRACE_MAGIC	0x564d5452	/* "VMTR" */
+#define VMTRACE_VERSION	1
+
+struct vmtrace_header {
+	uint32_t vh_magic;
+	uint32_t vh_version;
+	uint32_t vh_ncpus;
+	uint32_t vh_eventsize;		/* sizeof(struct vmtrace_event) */
+};
+
+#if OPT_VMTRACE
+
+extern volatile bool vmtrace_on;
+
+/*
+ * vmtrace_start - Turn the trace on, with a fresh set of rings; if
+ *                 LTRACE, also send the events to trace161.
+ * vmtrace_stop  - Turn the trace off, keeping what was recorded.
+ * vmtrace_save  - Write what was recorded to the file PATH.
+ */
+int vmtrace_start(bool ltrace);
+void vmtrace_stop(void);
+int vmtrace_save(const char *path);
+
+void vmtrace_log(unsigned type, unsigned aux, struct addrspace *as,
+		 uint32_t a, uint32_t b);
+
+#define VMTRACE(type, aux, as, a, b) \
+	(vmtrace_on ? vmtrace_log(type, aux, as, a, b) : (void)0)
+
+#else
+
+#define VMTRACE(type, aux, as, a, b) ((void)0)
+
+#endif
+
+#endif /* _VMTRACE_H_ */
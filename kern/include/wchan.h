@@ -66,6 +66,13 @@ bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
  */
 void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Same, but also wake up after NSECS nanoseconds if nobody else did.
+ * Returns true in that case.
+ */
+bool wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk,
+			 uint64_t nsecs);
+
 /*
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
@@ -76,5 +83,12 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Move all threads sleeping on FROM to TO without waking them up.
+ * Both spinlocks should be locked.
+ */
+void wchan_transferall(struct wchan *from, struct spinlock *fromlk,
+		       struct wchan *to, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
@@ -44,6 +44,7 @@
 #include <synch.h>
 #include <vm.h>
 #include <mainbus.h>
+#include <timer.h>
 #include <vfs.h>
 #include <device.h>
 #include <syscall.h>
@@ -131,6 +132,8 @@ boot(void)
 	KASSERT(curthread->t_curspl > 0);
 	mainbus_bootstrap();
 	KASSERT(curthread->t_curspl == 0);
+	/* Needs the real-time clock; CPU time is counted from here on. */
+	timer_bootstrap();
 	/* Now do pseudo-devices. */
 	pseudoconfig();
 	kprintf("\n");
@@ -43,9 +43,18 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <kheapprof.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-waitpid.h"
+#include "opt-lockprof.h"
+#include "opt-stats.h"
+
+#if OPT_STATS
+#include <vmstats.h>
+#endif
+#include <vmtrace.h>
+#include <vminfo.h>
 
 /*
  * In-kernel menu and command dispatcher.
@@ -164,6 +173,62 @@ cmd_prog(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+/*
+ * Command for running N copies of a program at once, each in a process
+ * of its own, e.g. for multi-process VM workloads. Waits for all of
+ * them to finish.
+ */
+#define PROGN_MAX 16
+
+static
+int
+cmd_progn(int nargs, char **args)
+{
+	struct proc *procs[PROGN_MAX];
+	int n, i, result;
+#if OPT_WAITPID
+	int j;
+#endif
+
+	n = nargs >= 3 ? atoi(args[1]) : 0;
+	if (n < 1 || n > PROGN_MAX) {
+		kprintf("Usage: pn copies program [arguments]\n");
+		kprintf("       (1 to %d copies)\n", PROGN_MAX);
+		return EINVAL;
+	}
+
+	/* drop the leading "pn copies" */
+	args += 2;
+	nargs -= 2;
+
+	result = 0;
+	for (i=0; i<n; i++) {
+		procs[i] = proc_create_runprogram(args[0] /* name */);
+		if (procs[i] == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		result = thread_fork(args[0] /* thread name */,
+				procs[i] /* new process */,
+				cmd_progthread /* thread function */,
+				args /* thread arg */, nargs /* thread arg */);
+		if (result) {
+			kprintf("thread_fork failed: %s\n", strerror(result));
+			proc_destroy(procs[i]);
+			break;
+		}
+	}
+
+#if OPT_WAITPID
+	for (j=0; j<i; j++) {
+		kprintf("exit status of process %d: %d\n", j,
+			proc_wait(procs[j]));
+	}
+#endif
+
+	return result;
+}
+
 /*
  * Command for starting the system shell.
  */
@@ -498,6 +563,160 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for the kernel heap profiler: turn it on or off, clear it,
+ * or print the N call sites with the most live bytes (default 20).
+ */
+static
+int
+cmd_kheapprof(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 1) {
+		kheapprof_print(20);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "on")) {
+		result = kheapprof_start();
+		if (result) {
+			kprintf("khprof: %s\n", strerror(result));
+			return result;
+		}
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheapprof_stop();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kheapprof_reset();
+	}
+	else if (nargs == 2 && atoi(args[1]) > 0) {
+		kheapprof_print(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: khprof [on | off | reset | N]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Command to show where the CPU time went, per cpu and per process.
+ */
+static
+int
+cmd_ps(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	cpu_printtimes();
+	kprintf("\n");
+	proc_printtimes();
+
+	return 0;
+}
+
+#if OPT_LOCKPROF
+/*
+ * Command to show (or clear) the lock contention profiles.
+ */
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+	if (nargs == 1) {
+		lockprof_print();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockprof_reset();
+	}
+	else {
+		kprintf("Usage: lp [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
+#if OPT_STATS
+/*
+ * Command to dump (or clear) the VM statistics, as key=value lines.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	if (nargs == 1) {
+		vmstats_dump();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vmstats_reset();
+	}
+	else {
+		kprintf("Usage: vms [reset]\n");
+	}
+
+	return 0;
+}
+#endif
+
+#if OPT_RUDEVM
+/*
+ * Command to show the memory of each process and the coremap.
+ */
+static
+int
+cmd_vminfo(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vminfo_print();
+
+	return 0;
+}
+#endif
+
+#if OPT_VMTRACE
+/*
+ * Command to control the VM event trace: turn it on (optionally
+ * mirrored to trace161) or off, or save it to a file, emu0:/vmtrace.bin
+ * by default.
+ */
+static
+int
+cmd_vmtrace(int nargs, char **args)
+{
+	int result = 0;
+
+	if (nargs >= 2 && nargs <= 3 && !strcmp(args[1], "on")) {
+		if (nargs == 3 && strcmp(args[2], "ltrace")) {
+			goto usage;
+		}
+		result = vmtrace_start(nargs == 3);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vmtrace_stop();
+	}
+	else if (nargs >= 2 && nargs <= 3 && !strcmp(args[1], "save")) {
+		result = vmtrace_save(nargs == 3 ? args[2] : "emu0:/vmtrace.bin");
+	}
+	else {
+		goto usage;
+	}
+
+	if (result) {
+		kprintf("vmtrace: %s\n", strerror(result));
+	}
+	return result;
+
+ usage:
+	kprintf("Usage: vmtrace on [ltrace] | off | save [file]\n");
+	return EINVAL;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -530,6 +749,7 @@ showmenu(const char *name, const char *x[])
 static const char *opsmenu[] = {
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
+	"[pn]      Several copies of program ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
@@ -567,6 +787,8 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Thread throughput test        ",
+	"[tt5] Thread creation test          ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
@@ -574,6 +796,11 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] Lock contention benchmark     ",
+	"[sy6] CV wakeup benchmark           ",
+	"[rwt1] Rwlock scaling test          ",
+	"[sp1] Spinlock fairness benchmark   ",
+	"[tm1] Timer precision test          ",
 	"[semu1-22] Semaphore unit tests     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
@@ -581,6 +808,7 @@ static const char *testmenu[] = {
 	"[fs4] FS write stress 2             ",
 	"[fs5] FS long stress                ",
 	"[fs6] FS create stress              ",
+	"[bench] Kernel microbenchmarks      ",
 	NULL
 };
 
@@ -605,6 +833,20 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profiler       ",
+	"[ps] CPU time per cpu and process   ",
+#if OPT_LOCKPROF
+	"[lp] Lock contention profile        ",
+#endif
+#if OPT_RUDEVM
+	"[vm] Process memory and coremap     ",
+#endif
+#if OPT_STATS
+	"[vms] VM statistics                 ",
+#endif
+#if OPT_VMTRACE
+	"[vmtrace] VM event trace            ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -638,6 +880,7 @@ static struct {
 	/* operations */
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+	{ "pn",		cmd_progn },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
@@ -656,6 +899,20 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprof },
+	{ "ps",         cmd_ps },
+#if OPT_LOCKPROF
+	{ "lp",         cmd_lockprof },
+#endif
+#if OPT_RUDEVM
+	{ "vm",         cmd_vminfo },
+#endif
+#if OPT_STATS
+	{ "vms",        cmd_vmstats },
+#endif
+#if OPT_VMTRACE
+	{ "vmtrace",    cmd_vmtrace },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -672,12 +929,19 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
+	{ "tt5",	threadtest5 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	lockbench },
+	{ "sy6",	cvbench },
+	{ "rwt1",	rwtest },
+	{ "sp1",	spinlocktest },
+	{ "tm1",	timertest },
 
 	/* semaphore unit tests */
 	{ "semu1",	semu1 },
@@ -711,6 +975,9 @@ static struct {
 	{ "fs5",	longstress },
 	{ "fs6",	createstress },
 
+	/* microbenchmarks */
+	{ "bench",	benchmark },
+
 	{ NULL, NULL }
 };
 
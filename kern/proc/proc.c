@@ -50,6 +50,7 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <syscall.h>
 #include "opt-waitpid.h"
 
 /*
@@ -57,6 +58,13 @@
  */
 struct proc *kproc;
 
+/*
+ * All processes, from creation to destruction, for proc_printtimes
+ * and proc_foreach.
+ */
+static struct proc *allprocs;
+static struct lock *allprocs_lock;
+
 #if OPT_WAITPID
 static void
 proc_init_waitpid(struct proc *proc, const char *name) {
@@ -98,6 +106,21 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 
+	proc->p_utime = 0;
+	proc->p_stime = 0;
+	proc->p_cutime = 0;
+	proc->p_cstime = 0;
+	proc->p_allnext = NULL;
+
+#if OPT_SYSCALLS
+	spinlock_init(&proc->p_filelock);
+	bzero(proc->p_filetable, sizeof(proc->p_filetable));
+	bzero(proc->p_uthreads, sizeof(proc->p_uthreads));
+	/* the main thread */
+	proc->p_uthreads[0].ut_used = true;
+	proc->p_exiting = false;
+#endif
+
 #if OPT_WAITPID
 	proc_init_waitpid(proc,name);
 #endif
@@ -105,6 +128,33 @@ proc_create(const char *name)
 	return proc;
 }
 
+/*
+ * Add a process to the list of all processes, and remove it.
+ */
+static
+void
+proc_list(struct proc *proc)
+{
+	lock_acquire(allprocs_lock);
+	proc->p_allnext = allprocs;
+	allprocs = proc;
+	lock_release(allprocs_lock);
+}
+
+static
+void
+proc_unlist(struct proc *proc)
+{
+	struct proc **pp;
+
+	lock_acquire(allprocs_lock);
+	for (pp = &allprocs; *pp != proc; pp = &(*pp)->p_allnext) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = proc->p_allnext;
+	lock_release(allprocs_lock);
+}
+
 /*
  * Destroy a proc structure.
  *
@@ -130,6 +180,8 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+	proc_unlist(proc);
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -137,6 +189,11 @@ proc_destroy(struct proc *proc)
 	 */
 
 	/* VFS fields */
+#if OPT_SYSCALLS
+	file_closeall(proc);
+	spinlock_cleanup(&proc->p_filelock);
+	uthread_destroyall(proc);
+#endif
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
@@ -207,10 +264,17 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	allprocs_lock = lock_create("allprocs");
+	if (allprocs_lock == NULL) {
+		panic("lock_create for allprocs failed\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
 	}
+	/* no threads yet, so no locking */
+	allprocs = kproc;
 }
 
 /*
@@ -247,6 +311,8 @@ proc_create_runprogram(const char *name)
 	}
 	spinlock_release(&curproc->p_lock);
 
+	proc_list(newproc);
+
 	return newproc;
 }
 
@@ -286,23 +352,94 @@ proc_addthread(struct proc *proc, struct thread *t)
  * the timer interrupt context switch, and any other implicit uses
  * of "curproc".
  */
-void
+bool
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
+	bool last;
 	int spl;
 
 	proc = t->t_proc;
 	KASSERT(proc != NULL);
 
+	proc_chargetimes(t);
+
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
 	proc->p_numthreads--;
+	last = proc->p_numthreads == 0;
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
 	t->t_proc = NULL;
 	splx(spl);
+
+	return last;
+}
+
+/*
+ * Add the CPU time the thread T used since the last call to its
+ * process. T must be current, or no longer running.
+ */
+void
+proc_chargetimes(struct thread *t)
+{
+	struct proc *proc = t->t_proc;
+
+	/* (holding the spinlock also keeps interrupts off) */
+	spinlock_acquire(&proc->p_lock);
+	proc->p_utime += t->t_utime - t->t_ucharged;
+	proc->p_stime += t->t_stime - t->t_scharged;
+	t->t_ucharged = t->t_utime;
+	t->t_scharged = t->t_stime;
+	spinlock_release(&proc->p_lock);
+}
+
+/*
+ * Print the CPU time of all processes, in milliseconds. Running
+ * threads are counted up to the last time they left the kernel.
+ */
+void
+proc_printtimes(void)
+{
+	struct proc *proc;
+	unsigned nthreads;
+	uint64_t ut, st, cut, cst;
+
+	kprintf("threads      user ms       sys ms   child user    child sys"
+		"  name\n");
+	lock_acquire(allprocs_lock);
+	for (proc = allprocs; proc != NULL; proc = proc->p_allnext) {
+		spinlock_acquire(&proc->p_lock);
+		nthreads = proc->p_numthreads;
+		ut = proc->p_utime;
+		st = proc->p_stime;
+		cut = proc->p_cutime;
+		cst = proc->p_cstime;
+		spinlock_release(&proc->p_lock);
+
+		kprintf("%7u %12llu %12llu %12llu %12llu  %s\n", nthreads,
+			ut / 1000000, st / 1000000, cut / 1000000,
+			cst / 1000000, proc->p_name);
+	}
+	lock_release(allprocs_lock);
+}
+
+/*
+ * Call FUNC on each process. Processes can't be destroyed (nor their
+ * address spaces, once they are set up) while the list is locked, so
+ * FUNC can look at them, but it must not create or destroy processes.
+ */
+void
+proc_foreach(void (*func)(struct proc *, void *), void *data)
+{
+	struct proc *proc;
+
+	lock_acquire(allprocs_lock);
+	for (proc = allprocs; proc != NULL; proc = proc->p_allnext) {
+		func(proc, data);
+	}
+	lock_release(allprocs_lock);
 }
 
 /*
@@ -360,6 +497,12 @@ int proc_wait(struct proc *proc){
 
 	P(proc -> p_sem);
 	return_status = proc->status;
+
+	/* the time of the child (and of its own children) goes to us */
+	spinlock_acquire(&curproc->p_lock);
+	curproc->p_cutime += proc->p_utime + proc->p_cutime;
+	curproc->p_cstime += proc->p_stime + proc->p_cstime;
+	spinlock_release(&curproc->p_lock);
 	/* 
 	 * destroy the address space of the 
 	 * process after getting the exit status
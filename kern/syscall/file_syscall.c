@@ -1,53 +1,564 @@
 /*
  * AUthor: G.Cabodi
  * Very simple implementation of sys_read and sys_write.
- * just works (partially) on stdin/stdout
+ * stdin/stdout/stderr go to the console, other file descriptors
+ * refer to files opened with sys_open.
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
 #include <kern/unistd.h>
+#include <limits.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
 #include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <stat.h>
+#include <vm.h>
+#include <addrspace.h>
+#include "opt-rudevm.h"
+
+#if OPT_RUDEVM
+/*
+ * Maximum number of user pages pinned at once by a single read/write.
+ * Every pinned frame is excluded from swap victim selection, so keep
+ * this small compared to the number of ram frames.
+ */
+#define PINNED_IO_PAGES 8
+#endif
+
+/*
+ * Look up an open file of the current process and take a reference
+ * to it, so that a close by another thread of the process cannot
+ * free it while it is in use. Drop it with file_put.
+ */
+static
+struct openfile *
+file_get(int fd)
+{
+  struct openfile *of;
+
+  if (fd < 0 || fd >= OPEN_MAX) {
+    return NULL;
+  }
+  spinlock_acquire(&curproc->p_filelock);
+  of = curproc->p_filetable[fd];
+  if (of != NULL) {
+    of->of_refcount++;
+  }
+  spinlock_release(&curproc->p_filelock);
+  return of;
+}
+
+/*
+ * Drop a reference to an open file of P; the last one closes it.
+ */
+static
+void
+file_put(struct proc *p, struct openfile *of)
+{
+  bool last;
+
+  spinlock_acquire(&p->p_filelock);
+  KASSERT(of->of_refcount > 0);
+  of->of_refcount--;
+  last = of->of_refcount == 0;
+  spinlock_release(&p->p_filelock);
+
+  if (last) {
+    vfs_close(of->of_vnode);
+    lock_destroy(of->of_lock);
+    kfree(of);
+  }
+}
+
+#if OPT_RUDEVM
+/**
+ * @brief zero-copy transfer between an open file and a list of user
+ * buffers. The user pages are faulted in and pinned a batch at a time,
+ * then a single VOP_READ/VOP_WRITE moves the data directly into/out of
+ * the frames through their kseg0 addresses. As the transfer can never
+ * page fault, the device driver never re-enters the VM (and the swap
+ * file on the same device) while it is holding its own locks.
+ *
+ * @param of
+ * @param uiov user buffers.
+ * @param uiovcnt number of user buffers.
+ * @param rw UIO_READ to read from the file into the buffers.
+ * @param done number of bytes transferred.
+ * @return 0 on success, error code otherwise.
+ */
+static
+int
+file_io(struct openfile *of, const struct iovec *uiov, unsigned uiovcnt,
+        enum uio_rw rw, size_t *done)
+{
+  struct addrspace *as;
+  struct iovec iov[PINNED_IO_PAGES];
+  paddr_t frames[PINNED_IO_PAGES];
+  struct uio u;
+  vaddr_t va;
+  size_t batch, chunk, moved, off, curoff;
+  unsigned npinned, i, c, cur;
+  int pinresult, result;
+
+  as = proc_getas();
+  *done = 0;
+  cur = 0;
+  curoff = 0;
+  pinresult = 0;
+  result = 0;
+
+  while (cur < uiovcnt && pinresult == 0) {
+    /* pin the next batch of pages, possibly spanning several buffers */
+    npinned = 0;
+    batch = 0;
+    c = cur;
+    off = curoff;
+    while (npinned < PINNED_IO_PAGES && c < uiovcnt) {
+      if (off == uiov[c].iov_len) {
+        c++;
+        off = 0;
+        continue;
+      }
+
+      va = (vaddr_t)uiov[c].iov_ubase + off;
+      chunk = PAGE_SIZE - (va & ~PAGE_FRAME);
+      if (chunk > uiov[c].iov_len - off) {
+        chunk = uiov[c].iov_len - off;
+      }
+
+      pinresult = vm_pin_upage(as, va, rw == UIO_READ, &frames[npinned]);
+      if (pinresult) {
+        break;
+      }
+
+      iov[npinned].iov_kbase = (void *)(PADDR_TO_KVADDR(frames[npinned]) +
+                                        (va & ~PAGE_FRAME));
+      iov[npinned].iov_len = chunk;
+      npinned++;
+      batch += chunk;
+      off += chunk;
+    }
+
+    if (npinned == 0) {
+      break;
+    }
+
+    u.uio_iov = iov;
+    u.uio_iovcnt = npinned;
+    u.uio_offset = of->of_offset;
+    u.uio_resid = batch;
+    u.uio_segflg = UIO_SYSSPACE;
+    u.uio_rw = rw;
+    u.uio_space = NULL;
+
+    if (rw == UIO_READ) {
+      result = VOP_READ(of->of_vnode, &u);
+    }
+    else {
+      result = VOP_WRITE(of->of_vnode, &u);
+    }
+
+    for (i = 0; i < npinned; i++) {
+      vm_unpin_upage(frames[i]);
+    }
+
+    moved = batch - u.uio_resid;
+    of->of_offset = u.uio_offset;
+    *done += moved;
+
+    /* advance the position within the user buffers */
+    while (moved > 0) {
+      chunk = uiov[cur].iov_len - curoff;
+      if (chunk > moved) {
+        chunk = moved;
+      }
+      curoff += chunk;
+      moved -= chunk;
+      if (curoff == uiov[cur].iov_len) {
+        cur++;
+        curoff = 0;
+      }
+    }
+
+    if (result || u.uio_resid > 0) {
+      /* error, or end of file */
+      break;
+    }
+  }
+
+  /* a partial transfer is reported as such, not as an error */
+  if (*done > 0) {
+    return 0;
+  }
+  return result ? result : pinresult;
+}
+#else
+/*
+ * Plain transfer through a user-space uio.
+ */
+static
+int
+file_io(struct openfile *of, const struct iovec *uiov, unsigned uiovcnt,
+        enum uio_rw rw, size_t *done)
+{
+  struct iovec *iov;
+  struct uio u;
+  size_t size;
+  unsigned i;
+  int result;
+
+  /* uiomove alters the iovecs, so work on a copy */
+  iov = kmalloc(uiovcnt * sizeof(struct iovec));
+  if (iov == NULL) {
+    return ENOMEM;
+  }
+  size = 0;
+  for (i = 0; i < uiovcnt; i++) {
+    iov[i] = uiov[i];
+    size += uiov[i].iov_len;
+  }
+
+  u.uio_iov = iov;
+  u.uio_iovcnt = uiovcnt;
+  u.uio_offset = of->of_offset;
+  u.uio_resid = size;
+  u.uio_segflg = UIO_USERSPACE;
+  u.uio_rw = rw;
+  u.uio_space = proc_getas();
+
+  if (rw == UIO_READ) {
+    result = VOP_READ(of->of_vnode, &u);
+  }
+  else {
+    result = VOP_WRITE(of->of_vnode, &u);
+  }
+  kfree(iov);
+
+  *done = size - u.uio_resid;
+  of->of_offset = u.uio_offset;
+  return (*done > 0) ? 0 : result;
+}
+#endif
+
+/*
+ * Read or write an open file, serializing on the file offset.
+ */
+static
+int
+file_rw(int fd, const struct iovec *iov, unsigned iovcnt, enum uio_rw rw,
+        int32_t *retval)
+{
+  struct openfile *of;
+  size_t done;
+  int accmode;
+  int result;
+
+  of = file_get(fd);
+  if (of == NULL) {
+    return EBADF;
+  }
+
+  accmode = of->of_flags & O_ACCMODE;
+  if ((rw == UIO_READ && accmode == O_WRONLY) ||
+      (rw == UIO_WRITE && accmode == O_RDONLY)) {
+    file_put(curproc, of);
+    return EBADF;
+  }
+
+  lock_acquire(of->of_lock);
+  result = file_io(of, iov, iovcnt, rw, &done);
+  lock_release(of->of_lock);
+  file_put(curproc, of);
+
+  if (result) {
+    return result;
+  }
+  *retval = (int32_t)done;
+  return 0;
+}
+
+/*
+ * simple file system calls for open/close
+ */
+int
+sys_open(userptr_t path, int openflags, mode_t mode, int32_t *retval)
+{
+  struct openfile *of;
+  struct vnode *v;
+  struct stat st;
+  char *kpath;
+  int fd;
+  int result;
+
+  kpath = kmalloc(PATH_MAX);
+  if (kpath == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr((const_userptr_t)path, kpath, PATH_MAX, NULL);
+  if (result) {
+    kfree(kpath);
+    return result;
+  }
+
+  /* vfs_open destroys the path string */
+  result = vfs_open(kpath, openflags, mode, &v);
+  kfree(kpath);
+  if (result) {
+    return result;
+  }
+
+  of = kmalloc(sizeof(struct openfile));
+  if (of == NULL) {
+    vfs_close(v);
+    return ENOMEM;
+  }
+  of->of_lock = lock_create("openfile");
+  if (of->of_lock == NULL) {
+    kfree(of);
+    vfs_close(v);
+    return ENOMEM;
+  }
+  of->of_vnode = v;
+  of->of_flags = openflags;
+  of->of_offset = 0;
+  of->of_refcount = 1;
+
+  if (openflags & O_APPEND) {
+    result = VOP_STAT(v, &st);
+    if (result) {
+      lock_destroy(of->of_lock);
+      kfree(of);
+      vfs_close(v);
+      return result;
+    }
+    of->of_offset = st.st_size;
+  }
+
+  /*
+   * take a free descriptor, stdin/stdout/stderr stay on the console.
+   * This is done last, in one go with the table locked, as the other
+   * threads of the process may be opening files too.
+   */
+  spinlock_acquire(&curproc->p_filelock);
+  for (fd = STDERR_FILENO + 1; fd < OPEN_MAX; fd++) {
+    if (curproc->p_filetable[fd] == NULL) {
+      curproc->p_filetable[fd] = of;
+      break;
+    }
+  }
+  spinlock_release(&curproc->p_filelock);
+  if (fd == OPEN_MAX) {
+    file_put(curproc, of);
+    return EMFILE;
+  }
+
+  *retval = fd;
+  return 0;
+}
+
+int
+sys_close(int fd)
+{
+  struct openfile *of;
+
+  if (fd < 0 || fd >= OPEN_MAX) {
+    return EBADF;
+  }
+  spinlock_acquire(&curproc->p_filelock);
+  of = curproc->p_filetable[fd];
+  curproc->p_filetable[fd] = NULL;
+  spinlock_release(&curproc->p_filelock);
+  if (of == NULL) {
+    return EBADF;
+  }
+
+  /* the file is closed when the I/O still using it is done */
+  file_put(curproc, of);
+  return 0;
+}
+
+/*
+ * Close all the files left open by a process.
+ */
+void
+file_closeall(struct proc *p)
+{
+  struct openfile *of;
+  int fd;
+
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    of = p->p_filetable[fd];
+    if (of != NULL) {
+      p->p_filetable[fd] = NULL;
+      file_put(p, of);
+    }
+  }
+}
 
 /*
  * simple file system calls for write/read
  */
 int
-sys_write(int fd, userptr_t buf_ptr, size_t size)
+sys_write(int fd, userptr_t buf_ptr, size_t size, int32_t *retval)
 {
   int i;
   char *p = (char *)buf_ptr;
 
+  struct iovec iov;
+
   if (fd!=STDOUT_FILENO && fd!=STDERR_FILENO) {
-    kprintf("sys_write supported only to stdout\n");
-    return -1;
+    iov.iov_ubase = buf_ptr;
+    iov.iov_len = size;
+    return file_rw(fd, &iov, 1, UIO_WRITE, retval);
   }
 
   for (i=0; i<(int)size; i++) {
     putch(p[i]);
   }
 
-  return (int)size;
+  *retval = (int32_t)size;
+  return 0;
 }
 
 int
-sys_read(int fd, userptr_t buf_ptr, size_t size)
+sys_read(int fd, userptr_t buf_ptr, size_t size, int32_t *retval)
 {
   int i;
   char *p = (char *)buf_ptr;
 
+  struct iovec iov;
+
   if (fd!=STDIN_FILENO) {
-    kprintf("sys_read supported only to stdin\n");
-    return -1;
+    iov.iov_ubase = buf_ptr;
+    iov.iov_len = size;
+    return file_rw(fd, &iov, 1, UIO_READ, retval);
   }
 
   for (i=0; i<(int)size; i++) {
     p[i] = getch();
-    if (p[i] < 0) 
-      return i;
+    if (p[i] < 0) {
+      *retval = i;
+      return 0;
+    }
   }
 
-  return (int)size;
-}
\ No newline at end of file
+  *retval = (int32_t)size;
+  return 0;
+}
+
+/*
+ * Copy in and check the iovec array of readv/writev.
+ */
+static
+int
+file_getiov(userptr_t iov_ptr, int iovcnt, struct iovec **ret)
+{
+  struct iovec *iov;
+  size_t total;
+  int i;
+  int result;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
+  }
+
+  iov = kmalloc(iovcnt * sizeof(struct iovec));
+  if (iov == NULL) {
+    return ENOMEM;
+  }
+  result = copyin((const_userptr_t)iov_ptr, iov, iovcnt * sizeof(struct iovec));
+  if (result) {
+    kfree(iov);
+    return result;
+  }
+
+  /* the total length must fit in the return value */
+  total = 0;
+  for (i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len > (size_t)0x7fffffff - total) {
+      kfree(iov);
+      return EINVAL;
+    }
+    total += iov[i].iov_len;
+  }
+
+  *ret = iov;
+  return 0;
+}
+
+/*
+ * scatter/gather versions of write/read: a single uio (and a single
+ * VOP_WRITE/VOP_READ) covers all the buffers.
+ */
+int
+sys_writev(int fd, userptr_t iov_ptr, int iovcnt, int32_t *retval)
+{
+  struct iovec *iov;
+  int32_t done, n;
+  int i;
+  int result;
+
+  result = file_getiov(iov_ptr, iovcnt, &iov);
+  if (result) {
+    return result;
+  }
+
+  if (fd!=STDOUT_FILENO && fd!=STDERR_FILENO) {
+    result = file_rw(fd, iov, iovcnt, UIO_WRITE, retval);
+    kfree(iov);
+    return result;
+  }
+
+  /* the console has no vnode, just write the buffers one at a time */
+  done = 0;
+  for (i = 0; i < iovcnt; i++) {
+    sys_write(fd, iov[i].iov_ubase, iov[i].iov_len, &n);
+    done += n;
+  }
+  kfree(iov);
+
+  *retval = done;
+  return 0;
+}
+
+int
+sys_readv(int fd, userptr_t iov_ptr, int iovcnt, int32_t *retval)
+{
+  struct iovec *iov;
+  int32_t done, n;
+  int i;
+  int result;
+
+  result = file_getiov(iov_ptr, iovcnt, &iov);
+  if (result) {
+    return result;
+  }
+
+  if (fd!=STDIN_FILENO) {
+    result = file_rw(fd, iov, iovcnt, UIO_READ, retval);
+    kfree(iov);
+    return result;
+  }
+
+  done = 0;
+  for (i = 0; i < iovcnt; i++) {
+    sys_read(fd, iov[i].iov_ubase, iov[i].iov_len, &n);
+    done += n;
+    if ((size_t)n < iov[i].iov_len) {
+      break;
+    }
+  }
+  kfree(iov);
+
+  *retval = done;
+  return 0;
+}
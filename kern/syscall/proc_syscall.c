@@ -6,6 +6,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/unistd.h>
 #include <clock.h>
 #include <copyinout.h>
@@ -23,30 +26,65 @@
 void
 sys__exit(int status)
 {
-  #if  OPT_WAITPID
   struct proc *p = curproc;
-  p->status = status & 0xff;
-  proc_remthread(curthread);
-
-  V(p->p_sem);
-  /* 
-   * here it is not destroyed the proc structure since the 
-   * process waiting for the termination of this process
-   * need the exits status, hence the it is freed 
-   * within the proc_wait().
+
+  /*
+   * _exit from any thread ends the whole process, with the status
+   * of the first call. The other threads are not waited for: they
+   * leave on their way back to user mode (see uthread_checkexit),
+   * and the last thread out completes the exit (see uthread_leave).
    */
+  spinlock_acquire(&p->p_lock);
+  if (!p->p_exiting) {
+    p->p_exiting = true;
+#if OPT_WAITPID
+    p->status = status & 0xff;
+#endif
+  }
+  spinlock_release(&p->p_lock);
 
-#else
+  uthread_leave();
+  (void) status;
+}
 
-  /* get address space of current process and destroy */
-  struct addrspace *as = proc_getas();
-  as_destroy(as);
-  
-#endif
+static void
+ns_to_timeval(uint64_t ns, struct timeval *tv)
+{
+  tv->tv_sec = ns / 1000000000;
+  tv->tv_usec = (ns % 1000000000) / 1000;
+}
+
+/*
+ * getrusage: only the CPU times are kept, the other fields are zero.
+ */
+int
+sys_getrusage(int who, userptr_t usage)
+{
+  struct proc *p = curproc;
+  struct rusage ru;
+  uint64_t utime, stime;
+
+  if (who != RUSAGE_SELF && who != RUSAGE_CHILDREN) {
+    return EINVAL;
+  }
+
+  /* bring our own time up to date first */
+  proc_chargetimes(curthread);
+
+  spinlock_acquire(&p->p_lock);
+  if (who == RUSAGE_SELF) {
+    utime = p->p_utime;
+    stime = p->p_stime;
+  }
+  else {
+    utime = p->p_cutime;
+    stime = p->p_cstime;
+  }
+  spinlock_release(&p->p_lock);
 
-  /* thread exits. proc data structure will be lost */
-  thread_exit();
+  bzero(&ru, sizeof(ru));
+  ns_to_timeval(utime, &ru.ru_utime);
+  ns_to_timeval(stime, &ru.ru_stime);
 
-  panic("thread_exit returned (should not happen)\n");
-  (void) status; // TODO: status handling
+  return copyout(&ru, usage, sizeof(ru));
 }
@@ -0,0 +1,215 @@
+/*
+ * Multithreaded user processes.
+ * Extra threads share the address space (and everything else) of
+ * their process; each of them runs on its own stack region, chosen
+ * by its slot in p_uthreads.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <proc.h>
+#include <thread.h>
+#include <current.h>
+#include <addrspace.h>
+#include <synch.h>
+#include <vm.h>
+#include <syscall.h>
+#include "opt-waitpid.h"
+
+/*
+ * Where a new user thread starts.
+ */
+struct uthread_entry {
+  vaddr_t ue_func;
+  userptr_t ue_arg;
+};
+
+/*
+ * First function run by a new user thread, in kernel mode.
+ */
+static
+void
+uthread_start(void *data1, unsigned long slot)
+{
+  struct uthread_entry *ue = data1;
+  vaddr_t func = ue->ue_func;
+  userptr_t arg = ue->ue_arg;
+  vaddr_t stackptr;
+
+  kfree(ue);
+
+  curthread->t_uslot = slot;
+  stackptr = as_get_stacktop(proc_getas(), slot);
+
+  /* created just as the process exits */
+  uthread_checkexit();
+
+  enter_new_thread(arg, stackptr, func);
+  panic("enter_new_thread returned\n");
+}
+
+/*
+ * Wait for the thread in the given slot to exit and release the slot.
+ * The caller must have set ut_joining.
+ */
+static
+void
+uthread_wait(struct proc *p, unsigned slot)
+{
+  P(p->p_uthreads[slot].ut_done);
+
+  spinlock_acquire(&p->p_lock);
+  p->p_uthreads[slot].ut_used = false;
+  p->p_uthreads[slot].ut_joining = false;
+  spinlock_release(&p->p_lock);
+}
+
+int
+sys_thread_create(userptr_t func, userptr_t arg, int32_t *retval)
+{
+  struct proc *p = curproc;
+  struct uthread_entry *ue;
+  unsigned slot;
+  int result;
+
+  if (func == NULL || (vaddr_t)func >= USERSPACETOP) {
+    return EFAULT;
+  }
+
+  spinlock_acquire(&p->p_lock);
+  for (slot = 1; slot < UTHREAD_MAX; slot++) {
+    if (!p->p_uthreads[slot].ut_used) {
+      p->p_uthreads[slot].ut_used = true;
+      break;
+    }
+  }
+  spinlock_release(&p->p_lock);
+
+  if (slot == UTHREAD_MAX) {
+    return EAGAIN;
+  }
+
+  /* slots are reused, and so are their semaphores */
+  if (p->p_uthreads[slot].ut_done == NULL) {
+    p->p_uthreads[slot].ut_done = sem_create("uthread", 0);
+    if (p->p_uthreads[slot].ut_done == NULL) {
+      result = ENOMEM;
+      goto fail;
+    }
+  }
+
+  ue = kmalloc(sizeof(struct uthread_entry));
+  if (ue == NULL) {
+    result = ENOMEM;
+    goto fail;
+  }
+  ue->ue_func = (vaddr_t)func;
+  ue->ue_arg = arg;
+
+  result = thread_fork(curthread->t_name, p, uthread_start, ue, slot);
+  if (result) {
+    kfree(ue);
+    goto fail;
+  }
+
+  *retval = slot;
+  return 0;
+
+fail:
+  spinlock_acquire(&p->p_lock);
+  p->p_uthreads[slot].ut_used = false;
+  spinlock_release(&p->p_lock);
+  return result;
+}
+
+int
+sys_thread_join(int tid)
+{
+  struct proc *p = curproc;
+
+  if (tid <= 0 || tid >= UTHREAD_MAX || (unsigned)tid == curthread->t_uslot) {
+    return EINVAL;
+  }
+
+  spinlock_acquire(&p->p_lock);
+  if (!p->p_uthreads[tid].ut_used || p->p_uthreads[tid].ut_joining) {
+    spinlock_release(&p->p_lock);
+    return ESRCH;
+  }
+  p->p_uthreads[tid].ut_joining = true;
+  spinlock_release(&p->p_lock);
+
+  uthread_wait(p, tid);
+  return 0;
+}
+
+void
+sys_thread_exit(void)
+{
+  if (curthread->t_uslot == 0) {
+    /* the main thread leaving ends the process */
+    sys__exit(0);
+  }
+  uthread_leave();
+}
+
+/*
+ * End the current thread. Once _exit has been called, the last
+ * thread to leave completes the exit of the process: until then the
+ * process, and the semaphores of its threads, stay around.
+ */
+void
+uthread_leave(void)
+{
+  struct proc *p = curproc;
+  unsigned slot = curthread->t_uslot;
+
+  if (slot != 0) {
+    V(p->p_uthreads[slot].ut_done);
+  }
+
+  if (proc_remthread(curthread)) {
+    KASSERT(p->p_exiting);
+#if OPT_WAITPID
+    /* the parent may destroy the process from here on */
+    V(p->p_sem);
+#else
+    as_destroy(p->p_addrspace);
+#endif
+  }
+
+  thread_exit();
+}
+
+/*
+ * Called on the way back to user mode: a thread of a process that is
+ * exiting leaves instead. p_exiting is only ever set, so it can be
+ * read without the lock; a thread that misses it goes on until its
+ * next trap, at the latest the next clock tick.
+ */
+void
+uthread_checkexit(void)
+{
+  struct proc *p = curproc;
+
+  if (p != NULL && p->p_exiting) {
+    uthread_leave();
+  }
+}
+
+/*
+ * Release the user thread slots of a process being destroyed.
+ */
+void
+uthread_destroyall(struct proc *p)
+{
+  unsigned slot;
+
+  for (slot = 0; slot < UTHREAD_MAX; slot++) {
+    if (p->p_uthreads[slot].ut_done != NULL) {
+      sem_destroy(p->p_uthreads[slot].ut_done);
+      p->p_uthreads[slot].ut_done = NULL;
+    }
+  }
+}
@@ -28,31 +28,73 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
 
 /*
- * Example system call: get the time of day.
+ * Example system call: get the time of day. Either pointer may be
+ * NULL, to skip that result.
  */
 int
 sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 {
 	struct timespec ts;
-	int result;
+	struct copyvec vec[2];
+	unsigned n;
 
 	gettime(&ts);
 
-	result = copyout(&ts.tv_sec, user_seconds_ptr, sizeof(ts.tv_sec));
-	if (result) {
-		return result;
+	/* the results are copied out in a single protected section */
+	n = 0;
+	if (user_seconds_ptr != NULL) {
+		vec[n].cv_kbase = &ts.tv_sec;
+		vec[n].cv_ubase = user_seconds_ptr;
+		vec[n].cv_len = sizeof(ts.tv_sec);
+		n++;
+	}
+	if (user_nanoseconds_ptr != NULL) {
+		vec[n].cv_kbase = &ts.tv_nsec;
+		vec[n].cv_ubase = user_nanoseconds_ptr;
+		vec[n].cv_len = sizeof(ts.tv_nsec);
+		n++;
+	}
+	if (n == 0) {
+		return 0;
 	}
 
-	result = copyout(&ts.tv_nsec, user_nanoseconds_ptr,
-			 sizeof(ts.tv_nsec));
+	return copyoutv(vec, n);
+}
+
+/*
+ * nanosleep: suspend the calling thread for the time in REQ. There are
+ * no signals, so the sleep is never cut short and the remaining time
+ * written to REM (if given) is always zero.
+ */
+int
+sys_nanosleep(userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
 	if (result) {
 		return result;
 	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
 
+	timer_sleep((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
 	return 0;
 }
@@ -0,0 +1,223 @@
+/*
+ * Kernel microbenchmark framework. See bench.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <timer.h>
+#include <bench.h>
+#include <test.h>
+
+#define BENCH_MAX 32
+
+/* how long the cycle counter is watched to find out its rate */
+#define BENCH_CALIBRATE_NS 10000000
+
+/* runs expected to take more cycles than this may have wrapped */
+#define BENCH_MAXCYCLES 0xf0000000ULL
+
+struct bench {
+	const char *b_name;
+	bench_fn b_fn;
+};
+
+static struct bench benches[BENCH_MAX];
+static unsigned nbenches;
+static bool bench_builtins;
+static uint64_t bench_cycles_per_ms;
+
+int
+bench_register(const char *name, bench_fn fn)
+{
+	unsigned i;
+
+	for (i=0; i<nbenches; i++) {
+		if (!strcmp(benches[i].b_name, name)) {
+			return EEXIST;
+		}
+	}
+	if (nbenches == BENCH_MAX) {
+		return ENOSPC;
+	}
+	benches[nbenches].b_name = name;
+	benches[nbenches].b_fn = fn;
+	nbenches++;
+	return 0;
+}
+
+static
+struct bench *
+bench_find(const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<nbenches; i++) {
+		if (!strcmp(benches[i].b_name, name)) {
+			return &benches[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Integer square root, rounded down.
+ */
+static
+uint64_t
+bench_isqrt(uint64_t x)
+{
+	uint64_t r, bit;
+
+	r = 0;
+	bit = (uint64_t)1 << 62;
+	while (bit > x) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (x >= r + bit) {
+			x -= r + bit;
+			r = (r >> 1) + bit;
+		}
+		else {
+			r >>= 1;
+		}
+		bit >>= 2;
+	}
+	return r;
+}
+
+/*
+ * Find out how fast the cycle counter runs, so that runs too long for
+ * it can be told from short ones: it is only 32 bits wide.
+ */
+static
+void
+bench_calibrate(void)
+{
+	uint32_t c0;
+	uint64_t t0, t;
+
+	c0 = cpu_cycles();
+	t0 = timer_now();
+	do {
+		t = timer_now();
+	} while (t - t0 < BENCH_CALIBRATE_NS);
+	bench_cycles_per_ms = (uint64_t)(cpu_cycles() - c0) * 1000000 / (t - t0);
+}
+
+int
+bench_run(const char *name, unsigned iters)
+{
+	struct bench *b;
+	uint32_t start, cycles;
+	uint64_t t0, ns;
+	uint64_t percent[BENCH_RUNS];	/* cycles per op, in hundredths */
+	uint64_t sum, mean, var, sd, min;
+	unsigned i;
+
+	b = bench_find(name);
+	if (b == NULL) {
+		return ENOENT;
+	}
+
+	for (i=0; i<BENCH_WARMUP; i++) {
+		b->b_fn(iters);
+	}
+
+	sum = 0;
+	min = (uint64_t)-1;
+	for (i=0; i<BENCH_RUNS; i++) {
+		t0 = timer_now();
+		start = cpu_cycles();
+		b->b_fn(iters);
+		/* unsigned subtraction is right across a wraparound... */
+		cycles = cpu_cycles() - start;
+		ns = timer_now() - t0;
+
+		/* ...as long as less than 2^32 cycles went by */
+		if (ns / 1000 * bench_cycles_per_ms / 1000 >= BENCH_MAXCYCLES) {
+			kprintf("%-16s %8u ops  too long for the cycle counter, "
+				"use fewer\n", name, iters);
+			return ERANGE;
+		}
+
+		percent[i] = (uint64_t)cycles * 100 / iters;
+		sum += percent[i];
+		if (percent[i] < min) {
+			min = percent[i];
+		}
+	}
+	mean = sum / BENCH_RUNS;
+
+	var = 0;
+	for (i=0; i<BENCH_RUNS; i++) {
+		sd = percent[i] > mean ? percent[i] - mean : mean - percent[i];
+		var += sd * sd;
+	}
+	sd = bench_isqrt(var / BENCH_RUNS);
+
+	kprintf("%-16s %8u ops  cycles/op: mean %llu.%02llu  "
+		"stddev %llu.%02llu  min %llu.%02llu\n", name, iters,
+		mean / 100, mean % 100, sd / 100, sd % 100,
+		min / 100, min % 100);
+	return 0;
+}
+
+/*
+ * Menu command:
+ *    bench                  list the benchmarks
+ *    bench all [ITERS]      run all of them
+ *    bench NAME [ITERS]     run one
+ *
+ * The benchmarks run the real kernel code, so most of them leave their
+ * traces in the stats (see bench.h): run "vms reset" after them before
+ * measuring anything else.
+ */
+int
+benchmark(int nargs, char **args)
+{
+	unsigned i, iters;
+	int result;
+
+	if (!bench_builtins) {
+		benchmarks_register();
+		bench_calibrate();
+		bench_builtins = true;
+	}
+
+	if (nargs == 1) {
+		kprintf("Benchmarks:");
+		for (i=0; i<nbenches; i++) {
+			kprintf(" %s", benches[i].b_name);
+		}
+		kprintf("\n");
+		return 0;
+	}
+
+	iters = BENCH_ITERS;
+	if (nargs == 3) {
+		iters = atoi(args[2]);
+	}
+	if (nargs > 3 || iters == 0) {
+		kprintf("Usage: bench [all | NAME] [ITERS]\n");
+		kprintf("The VM stats count the benchmarks: vms reset after.\n");
+		return EINVAL;
+	}
+
+	kprintf("%u warmup runs, %u timed runs, cycle counter at %llu kHz\n",
+		BENCH_WARMUP, BENCH_RUNS, bench_cycles_per_ms);
+	if (!strcmp(args[1], "all")) {
+		for (i=0; i<nbenches; i++) {
+			bench_run(benches[i].b_name, iters);
+		}
+		return 0;
+	}
+
+	result = bench_run(args[1], iters);
+	if (result) {
+		kprintf("bench: %s: %s\n", args[1], strerror(result));
+	}
+	return result;
+}
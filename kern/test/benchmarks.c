@@ -0,0 +1,239 @@
+/*
+ * Built-in kernel microbenchmarks. See bench.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <thread.h>
+#include <synch.h>
+#include <bitmap.h>
+#include <vm.h>
+#include <bench.h>
+#include "opt-rudevm.h"
+
+#if OPT_RUDEVM
+#include <mips/tlb.h>
+#include <coremap.h>
+#include <vm_tlb.h>
+#endif
+
+/*
+ * kmalloc + kfree of one block, for each size class.
+ */
+#define BENCH_KMALLOC(size) \
+	static void \
+	bench_kmalloc##size(unsigned iters) \
+	{ \
+		unsigned i; \
+		for (i=0; i<iters; i++) { \
+			kfree(kmalloc(size)); \
+		} \
+	}
+
+BENCH_KMALLOC(16)
+BENCH_KMALLOC(32)
+BENCH_KMALLOC(64)
+BENCH_KMALLOC(128)
+BENCH_KMALLOC(256)
+BENCH_KMALLOC(512)
+BENCH_KMALLOC(1024)
+BENCH_KMALLOC(2048)
+
+/*
+ * P/V handoff: a partner thread and this one pass control back and
+ * forth through two semaphores; one op is a round trip, i.e. two
+ * handoffs and (on one cpu) two context switches.
+ */
+static struct semaphore *bench_ping;
+static struct semaphore *bench_pong;
+static struct semaphore *bench_done;
+
+static
+void
+bench_pongthread(void *junk, unsigned long iters)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<iters; i++) {
+		P(bench_ping);
+		V(bench_pong);
+	}
+	V(bench_done);
+}
+
+static
+void
+bench_semhandoff(unsigned iters)
+{
+	unsigned i;
+	int result;
+
+	result = thread_fork("bench_pong", NULL, bench_pongthread, NULL, iters);
+	if (result) {
+		panic("bench: thread_fork failed: %s\n", strerror(result));
+	}
+	for (i=0; i<iters; i++) {
+		V(bench_ping);
+		P(bench_pong);
+	}
+	P(bench_done);
+}
+
+/*
+ * thread_yield: a partner thread yields as many times as this one;
+ * with both on this cpu each yield switches to the other, so one op is
+ * a round trip of two context switches. (If the partner is started or
+ * migrated elsewhere the yields find nothing to switch to, and the
+ * figure is just the cost of a yield.)
+ */
+static
+void
+bench_yieldthread(void *junk, unsigned long iters)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<iters; i++) {
+		thread_yield();
+	}
+	V(bench_done);
+}
+
+static
+void
+bench_yield(unsigned iters)
+{
+	unsigned i;
+	int result;
+
+	result = thread_fork("bench_yield", NULL, bench_yieldthread, NULL,
+			     iters);
+	if (result) {
+		panic("bench: thread_fork failed: %s\n", strerror(result));
+	}
+	for (i=0; i<iters; i++) {
+		thread_yield();
+	}
+	P(bench_done);
+}
+
+/*
+ * bitmap_alloc + bitmap_unmark on a bitmap whose first half is in
+ * use, so every allocation scans past it.
+ */
+#define BENCH_BITMAPBITS 1024
+
+static struct bitmap *bench_bitmap;
+
+static
+void
+bench_bitmapalloc(unsigned iters)
+{
+	unsigned i, index;
+
+	for (i=0; i<iters; i++) {
+		if (bitmap_alloc(bench_bitmap, &index)) {
+			panic("bench: bitmap full\n");
+		}
+		bitmap_unmark(bench_bitmap, index);
+	}
+}
+
+#if OPT_RUDEVM
+
+/*
+ * coremap_getppages + coremap_freeppages of one kernel frame. This is
+ * the path with free frames: if memory is full, each allocation evicts
+ * a user page, which is a different (and real) cost.
+ */
+static
+void
+bench_coremap(unsigned iters)
+{
+	unsigned i;
+	paddr_t pa;
+
+	for (i=0; i<iters; i++) {
+		pa = coremap_getppages(1, NULL, NULL);
+		if (pa == 0) {
+			panic("bench: out of memory\n");
+		}
+		coremap_freeppages(pa);
+	}
+}
+
+/*
+ * TLB insertion of user pages, all mapped to one kernel frame that is
+ * never accessed through them. Page I goes in slot I % NUM_TLB, since
+ * the TLB is filled round robin from slot 0 after a flush, so no two
+ * entries ever match the same address. The TLB is flushed at the end,
+ * and interrupts are off meanwhile, so that no user process can run
+ * with these entries.
+ *
+ * The raw versions of the TLB functions are used: the inserts are not
+ * faults and must not show up as such in the VM stats and trace.
+ */
+static
+void
+bench_tlbinsert(unsigned iters)
+{
+	unsigned i;
+	vaddr_t frame;
+	int spl;
+
+	frame = alloc_kpages(1);
+	if (frame == 0) {
+		panic("bench: out of memory\n");
+	}
+
+	spl = splhigh();
+	tlb_invalidate_raw();
+	for (i=0; i<iters; i++) {
+		tlb_insert_raw((i % NUM_TLB) * PAGE_SIZE,
+			       KVADDR_TO_PADDR(frame), true);
+	}
+	tlb_invalidate_raw();
+	splx(spl);
+
+	free_kpages(frame);
+}
+
+#endif /* OPT_RUDEVM */
+
+void
+benchmarks_register(void)
+{
+	unsigned i;
+
+	bench_ping = sem_create("bench_ping", 0);
+	bench_pong = sem_create("bench_pong", 0);
+	bench_done = sem_create("bench_done", 0);
+	bench_bitmap = bitmap_create(BENCH_BITMAPBITS);
+	if (bench_ping == NULL || bench_pong == NULL || bench_done == NULL ||
+	    bench_bitmap == NULL) {
+		panic("bench: out of memory\n");
+	}
+	for (i=0; i<BENCH_BITMAPBITS/2; i++) {
+		bitmap_mark(bench_bitmap, i);
+	}
+
+	bench_register("kmalloc16", bench_kmalloc16);
+	bench_register("kmalloc32", bench_kmalloc32);
+	bench_register("kmalloc64", bench_kmalloc64);
+	bench_register("kmalloc128", bench_kmalloc128);
+	bench_register("kmalloc256", bench_kmalloc256);
+	bench_register("kmalloc512", bench_kmalloc512);
+	bench_register("kmalloc1024", bench_kmalloc1024);
+	bench_register("kmalloc2048", bench_kmalloc2048);
+	bench_register("semhandoff", bench_semhandoff);
+	bench_register("yield", bench_yield);
+	bench_register("bitmap_alloc", bench_bitmapalloc);
+#if OPT_RUDEVM
+	bench_register("coremap", bench_coremap);
+	bench_register("tlb_insert", bench_tlbinsert);
+#endif
+}
@@ -33,6 +33,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
 #include <thread.h>
 #include <synch.h>
 #include <vm.h> /* for PAGE_SIZE */
@@ -40,6 +41,30 @@
 
 #include "opt-dumbvm.h"
 
+////////////////////////////////////////////////////////////
+// throughput
+
+/*
+ * Print how many kmalloc and kfree calls per second a test did,
+ * counting each of them as one operation.
+ */
+static
+void
+kmalloc_report(const char *name, unsigned ops, const struct timespec *start)
+{
+	struct timespec now;
+	uint64_t us;
+
+	gettime(&now);
+	timespec_sub(&now, start, &now);
+	us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	if (us == 0) {
+		us = 1;
+	}
+	kprintf("%s: %u operations in %llu us, %llu ops/s\n", name, ops,
+		us, (uint64_t)ops * 1000000 / us);
+}
+
 ////////////////////////////////////////////////////////////
 // km1/km2
 
@@ -100,11 +125,15 @@ done:
 int
 kmalloctest(int nargs, char **args)
 {
+	struct timespec start;
+
 	(void)nargs;
 	(void)args;
 
 	kprintf("Starting kmalloc test...\n");
+	gettime(&start);
 	kmallocthread(NULL, 0);
+	kmalloc_report("km1", 2 * NTRIES, &start);
 	kprintf("kmalloc test done\n");
 
 	return 0;
@@ -114,6 +143,7 @@ int
 kmallocstress(int nargs, char **args)
 {
 	struct semaphore *sem;
+	struct timespec start;
 	int i, result;
 
 	(void)nargs;
@@ -126,6 +156,7 @@ kmallocstress(int nargs, char **args)
 
 	kprintf("Starting kmalloc stress test...\n");
 
+	gettime(&start);
 	for (i=0; i<NTHREADS; i++) {
 		result = thread_fork("kmallocstress", NULL,
 				     kmallocthread, sem, i);
@@ -138,6 +169,7 @@ kmallocstress(int nargs, char **args)
 	for (i=0; i<NTHREADS; i++) {
 		P(sem);
 	}
+	kmalloc_report("km2", NTHREADS * 2 * NTRIES, &start);
 
 	sem_destroy(sem);
 	kprintf("kmalloc stress test done\n");
@@ -183,6 +215,7 @@ kmalloctest3(int nargs, char **args)
 	size_t totalsize;
 	unsigned i, j;
 	unsigned char *ptr;
+	struct timespec start;
 
 	if (nargs != 2) {
 		kprintf("kmalloctest3: usage: km3 numobjects\n");
@@ -214,6 +247,7 @@ kmalloctest3(int nargs, char **args)
 	}
 
 	/* Allocate the objects. */
+	gettime(&start);
 	curblock = 0;
 	curpos = 0;
 	cursizeindex = 0;
@@ -279,6 +313,7 @@ kmalloctest3(int nargs, char **args)
 		cursizeindex = (cursizeindex + 1) % NUM_KM3_SIZES;
 	}
 	KASSERT(totalsize == 0);
+	kmalloc_report("km3", 2 * numptrs, &start);
 
 	/* Free the lower tier. */
 	for (i=0; i<numptrblocks; i++) {
@@ -341,6 +376,7 @@ int
 kmalloctest4(int nargs, char **args)
 {
 	struct semaphore *sem;
+	struct timespec start;
 	unsigned nthreads;
 	unsigned i;
 	int result;
@@ -361,6 +397,7 @@ kmalloctest4(int nargs, char **args)
 	/* use 6 instead of 8 threads */
 	nthreads = (3*NTHREADS)/4;
 
+	gettime(&start);
 	for (i=0; i<nthreads; i++) {
 		result = thread_fork("kmalloctest4", NULL,
 				     kmalloctest4thread, sem, i);
@@ -373,6 +410,7 @@ kmalloctest4(int nargs, char **args)
 	for (i=0; i<nthreads; i++) {
 		P(sem);
 	}
+	kmalloc_report("km4", nthreads * 2 * NTRIES, &start);
 
 	sem_destroy(sem);
 	kprintf("Multipage kmalloc test done\n");
@@ -0,0 +1,168 @@
+/*
+ * Reader-writer lock tests.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define RWT_MAXTHREADS  32
+#define RWT_LOOPS       2000
+#define RWT_WRITEFREQ   64	/* one operation in this many is a write */
+#define RWT_NWORDS      32
+
+/*
+ * The protected data: a writer bumps all the words, so a reader that
+ * sees two different values caught a writer in the middle.
+ */
+static volatile unsigned rwt_data[RWT_NWORDS];
+
+static struct rwlock *rwt_rwlock;
+static struct lock *rwt_lock;
+static struct semaphore *rwt_donesem;
+static volatile bool rwt_userw;
+
+static
+void
+rwt_read(void)
+{
+	unsigned i, first;
+
+	first = rwt_data[0];
+	for (i=1; i<RWT_NWORDS; i++) {
+		if (rwt_data[i] != first) {
+			panic("rwtest: reader saw a write in progress\n");
+		}
+	}
+}
+
+static
+void
+rwt_write(void)
+{
+	unsigned i;
+
+	for (i=0; i<RWT_NWORDS; i++) {
+		rwt_data[i]++;
+	}
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+
+	for (i=0; i<RWT_LOOPS; i++) {
+		/* stagger the writes of the different threads */
+		if ((i + num) % RWT_WRITEFREQ == 0) {
+			if (rwt_userw) {
+				rwlock_acquire_write(rwt_rwlock);
+				rwt_write();
+				rwlock_release_write(rwt_rwlock);
+			}
+			else {
+				lock_acquire(rwt_lock);
+				rwt_write();
+				lock_release(rwt_lock);
+			}
+		}
+		else {
+			if (rwt_userw) {
+				rwlock_acquire_read(rwt_rwlock);
+				rwt_read();
+				rwlock_release_read(rwt_rwlock);
+			}
+			else {
+				lock_acquire(rwt_lock);
+				rwt_read();
+				lock_release(rwt_lock);
+			}
+		}
+	}
+	V(rwt_donesem);
+}
+
+/*
+ * Run NTHREADS threads over the data, using the rwlock or the plain
+ * lock; return the number of operations per second.
+ */
+static
+unsigned
+rwt_run(unsigned nthreads, bool userw)
+{
+	struct timespec start, end;
+	unsigned i, ms;
+	int result;
+
+	rwt_userw = userw;
+
+	gettime(&start);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(rwt_donesem);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &end);
+	ms = end.tv_sec * 1000 + end.tv_nsec / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+	return nthreads * RWT_LOOPS * 1000 / ms;
+}
+
+/*
+ * Scaling test: for 1 to N threads (N defaults to the number of CPUs,
+ * so there is about one thread per CPU), compare the throughput of a
+ * read-mostly workload under the rwlock and under a plain lock.
+ */
+int
+rwtest(int nargs, char **args)
+{
+	unsigned maxthreads, n;
+
+	if (nargs > 2) {
+		kprintf("Usage: rwt1 [maxthreads]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs > 1 ? (unsigned)atoi(args[1]) : cpu_count();
+	if (maxthreads == 0 || maxthreads > RWT_MAXTHREADS) {
+		kprintf("rwtest: 1 to %u threads\n", RWT_MAXTHREADS);
+		return EINVAL;
+	}
+
+	if (rwt_rwlock == NULL) {
+		rwt_rwlock = rwlock_create("rwtest");
+		rwt_lock = lock_create("rwtest");
+		rwt_donesem = sem_create("rwtest", 0);
+		if (rwt_rwlock == NULL || rwt_lock == NULL ||
+		    rwt_donesem == NULL) {
+			panic("rwtest: out of memory\n");
+		}
+	}
+
+	kprintf("Starting rwlock scaling test: 1 write in %u operations\n",
+		RWT_WRITEFREQ);
+	kprintf("threads   rwlock ops/s    lock ops/s\n");
+	for (n=1; n<=maxthreads; n++) {
+		kprintf("%7u %14u %13u\n", n, rwt_run(n, true),
+			rwt_run(n, false));
+	}
+
+	kprintf("rwlock scaling test done.\n");
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Spinlock benchmark.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SPT_MAXTHREADS  32
+#define SPT_DEFAULTMS   500
+#define SPT_WORK        20	/* iterations inside the critical section */
+
+static struct spinlock spt_taslock;
+static struct spinlock spt_ticketlock;
+static struct spinlock *spt_lock;
+static struct semaphore *spt_donesem;
+static volatile bool spt_stop;
+static volatile unsigned spt_count[SPT_MAXTHREADS];
+static volatile unsigned spt_shared;
+
+static
+void
+spinlocktestthread(void *junk, unsigned long num)
+{
+	volatile unsigned i;
+	unsigned count = 0;
+
+	(void)junk;
+
+	while (!spt_stop) {
+		spinlock_acquire(spt_lock);
+		for (i=0; i<SPT_WORK; i++) {
+			spt_shared++;
+		}
+		spinlock_release(spt_lock);
+		count++;
+	}
+	spt_count[num] = count;
+	V(spt_donesem);
+}
+
+/*
+ * Hammer LOCK with NTHREADS threads for MS milliseconds, and print the
+ * throughput and how evenly the acquisitions were spread among the
+ * threads: the least and most a thread got, and Jain's fairness index
+ * (1 when all threads got the same share, 1/n when one got them all).
+ */
+static
+void
+spt_run(const char *name, struct spinlock *lock, unsigned nthreads,
+	unsigned ms)
+{
+	uint64_t total, sumsq;
+	unsigned i, min, max, fairness;
+	int result;
+
+	spt_lock = lock;
+	spt_stop = false;
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinlocktest", NULL, spinlocktestthread,
+				     NULL, i);
+		if (result) {
+			panic("spinlocktest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	timer_sleep((uint64_t)ms * 1000000);
+	spt_stop = true;
+	for (i=0; i<nthreads; i++) {
+		P(spt_donesem);
+	}
+
+	total = sumsq = 0;
+	min = max = spt_count[0];
+	for (i=0; i<nthreads; i++) {
+		total += spt_count[i];
+		sumsq += (uint64_t)spt_count[i] * spt_count[i];
+		if (spt_count[i] < min) {
+			min = spt_count[i];
+		}
+		if (spt_count[i] > max) {
+			max = spt_count[i];
+		}
+	}
+	fairness = sumsq == 0 ? 1000 : total * total * 1000 / (nthreads * sumsq);
+
+	kprintf("%-7s %3u threads: %9llu acq/s, per thread min %u max %u, "
+		"fairness %u.%03u\n", name, nthreads, total * 1000 / ms,
+		min, max, fairness / 1000, fairness % 1000);
+}
+
+/*
+ * Compare test-and-set and ticket spinlocks, with 1 to N threads (N
+ * defaults to the number of CPUs; more threads than that mostly
+ * measures the scheduler).
+ */
+int
+spinlocktest(int nargs, char **args)
+{
+	unsigned maxthreads, ms, n;
+
+	if (nargs > 3) {
+		kprintf("Usage: sp1 [maxthreads [ms]]\n");
+		return EINVAL;
+	}
+	maxthreads = nargs > 1 ? (unsigned)atoi(args[1]) : cpu_count();
+	ms = nargs > 2 ? (unsigned)atoi(args[2]) : SPT_DEFAULTMS;
+	if (maxthreads == 0 || maxthreads > SPT_MAXTHREADS || ms == 0) {
+		kprintf("spinlocktest: 1 to %u threads, at least 1 ms\n",
+			SPT_MAXTHREADS);
+		return EINVAL;
+	}
+
+	if (spt_donesem == NULL) {
+		spinlock_init(&spt_taslock);
+		spinlock_init_ticket(&spt_ticketlock);
+		spt_donesem = sem_create("spinlocktest", 0);
+		if (spt_donesem == NULL) {
+			panic("spinlocktest: sem_create failed\n");
+		}
+	}
+
+	kprintf("Starting spinlock benchmark, %u ms per run\n", ms);
+	for (n=1; n<=maxthreads; n++) {
+		spt_run("tas", &spt_taslock, n, ms);
+		spt_run("ticket", &spt_ticketlock, n, ms);
+	}
+	kprintf("Spinlock benchmark done.\n");
+	return 0;
+}
@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -399,3 +400,298 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Lock contention benchmark.
+ *
+ * Several threads hammer the same lock with a tiny critical section.
+ * A first run measures the raw acquisition rate; a second one stamps
+ * the time at each release and, whenever the lock changes hands,
+ * measures how long the next holder took to get it.
+ */
+
+#define LOCKBENCH_THREADS 4
+#define LOCKBENCH_LOOPS   5000
+
+static struct lock *benchlock;
+static volatile unsigned long benchcount;
+static volatile bool bench_timed;
+static volatile unsigned long bench_lastholder;
+static struct timespec bench_released;
+static unsigned bench_handoffs;
+static uint64_t bench_handoff_ns;	/* summed in ns, divided at the end */
+static uint64_t bench_handoff_maxns;
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	unsigned long loops = (unsigned long)junk;
+	unsigned long i;
+	struct timespec now;
+	uint64_t ns;
+
+	for (i=0; i<loops; i++) {
+		lock_acquire(benchlock);
+		if (bench_timed) {
+			if (bench_lastholder != num && benchcount > 0) {
+				gettime(&now);
+				timespec_sub(&now, &bench_released, &now);
+				ns = (uint64_t)now.tv_sec * 1000000000 +
+					now.tv_nsec;
+				bench_handoffs++;
+				bench_handoff_ns += ns;
+				if (ns > bench_handoff_maxns) {
+					bench_handoff_maxns = ns;
+				}
+			}
+			bench_lastholder = num;
+		}
+		benchcount++;
+		if (bench_timed) {
+			gettime(&bench_released);
+		}
+		lock_release(benchlock);
+	}
+	V(donesem);
+}
+
+/*
+ * Run one round of the benchmark; return the elapsed time in ns.
+ */
+static
+uint64_t
+lockbench_run(unsigned nthreads, unsigned long loops, bool timed)
+{
+	struct timespec start, end;
+	unsigned i;
+	int result;
+
+	benchcount = 0;
+	bench_timed = timed;
+	bench_lastholder = nthreads;
+	bench_handoffs = 0;
+	bench_handoff_ns = 0;
+	bench_handoff_maxns = 0;
+
+	gettime(&start);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     (void *)loops, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(donesem);
+	}
+	gettime(&end);
+
+	if (benchcount != nthreads * loops) {
+		panic("lockbench: count is %lu, expected %lu\n",
+		      benchcount, nthreads * loops);
+	}
+
+	timespec_sub(&end, &start, &end);
+	return (uint64_t)end.tv_sec * 1000000000 + end.tv_nsec;
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	unsigned nthreads = LOCKBENCH_THREADS;
+	unsigned long loops = LOCKBENCH_LOOPS;
+	uint64_t ns, avg;
+
+	if (nargs > 3) {
+		kprintf("Usage: sy5 [threads [loops]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		nthreads = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		loops = atoi(args[2]);
+	}
+	if (nthreads == 0 || nthreads > NTHREADS || loops == 0) {
+		kprintf("lockbench: 1 to %u threads, at least one loop\n",
+			NTHREADS);
+		return EINVAL;
+	}
+
+	inititems();
+	if (benchlock == NULL) {
+		benchlock = lock_create("benchlock");
+		if (benchlock == NULL) {
+			panic("lockbench: lock_create failed\n");
+		}
+	}
+
+	kprintf("Starting lock benchmark: %u threads, %lu loops each...\n",
+		nthreads, loops);
+
+	ns = lockbench_run(nthreads, loops, false);
+	if (ns == 0) {
+		ns = 1;
+	}
+	kprintf("lockbench: %lu acquisitions in %llu us, %llu per second\n",
+		benchcount, ns / 1000,
+		(uint64_t)benchcount * 1000000000 / ns);
+
+	lockbench_run(nthreads, loops, true);
+	if (bench_handoffs > 0) {
+		avg = bench_handoff_ns / bench_handoffs;
+		kprintf("lockbench: %u handoffs, average %llu.%03llu us, "
+			"max %llu.%03llu us\n", bench_handoffs,
+			avg / 1000, avg % 1000,
+			bench_handoff_maxns / 1000, bench_handoff_maxns % 1000);
+	}
+	else {
+		kprintf("lockbench: the lock never changed hands\n");
+	}
+
+	kprintf("Lock benchmark done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * CV wakeup benchmark.
+ *
+ * A set of waiters sleeps on a CV; each round the producer bumps a
+ * generation number and wakes them all, either with cv_broadcast or
+ * with one cv_signal per waiter (which lets them all race for the
+ * lock). Every return from cv_wait and every time a waiter had to go
+ * back to sleep on the lock counts as a wakeup; the ideal is one per
+ * waiter per round.
+ */
+
+#define CVBENCH_WAITERS 8
+#define CVBENCH_ROUNDS  100
+
+static struct lock *cvbenchlock;
+static struct cv *cvbenchcv;
+static volatile unsigned cvbench_gen;
+static volatile unsigned cvbench_rounds;
+static volatile unsigned cvbench_wakeups;
+
+static
+void
+cvbenchthread(void *junk, unsigned long num)
+{
+	unsigned mygen;
+
+	(void)junk;
+	(void)num;
+
+	/* start from 0 even if we are late and the producer has begun */
+	mygen = 0;
+	lock_acquire(cvbenchlock);
+	while (mygen < cvbench_rounds) {
+		while (cvbench_gen == mygen) {
+			cv_wait(cvbenchcv, cvbenchlock);
+			cvbench_wakeups++;
+		}
+		mygen = cvbench_gen;
+		lock_release(cvbenchlock);
+		V(donesem);
+		lock_acquire(cvbenchlock);
+	}
+	lock_release(cvbenchlock);
+}
+
+static
+void
+cvbench_run(unsigned nwaiters, unsigned rounds, bool broadcast)
+{
+	struct timespec start, end;
+	unsigned i, r, wakeups, ms;
+	int result;
+
+	cvbench_gen = 0;
+	cvbench_rounds = rounds;
+	cvbench_wakeups = 0;
+	cvbenchlock->lk_nsleeps = 0;
+
+	for (i=0; i<nwaiters; i++) {
+		result = thread_fork("cvbench", NULL, cvbenchthread, NULL, i);
+		if (result) {
+			panic("cvbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	gettime(&start);
+	for (r=0; r<rounds; r++) {
+		lock_acquire(cvbenchlock);
+		cvbench_gen++;
+		if (broadcast) {
+			cv_broadcast(cvbenchcv, cvbenchlock);
+		}
+		else {
+			for (i=0; i<nwaiters; i++) {
+				cv_signal(cvbenchcv, cvbenchlock);
+			}
+		}
+		lock_release(cvbenchlock);
+
+		for (i=0; i<nwaiters; i++) {
+			P(donesem);
+		}
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &end);
+	ms = end.tv_sec * 1000 + end.tv_nsec / 1000000;
+	wakeups = cvbench_wakeups + cvbenchlock->lk_nsleeps;
+	kprintf("cvbench: %-9s %u.%02u wakeups per signal "
+		"(ideal %u), %u went back to sleep, %u ms\n",
+		broadcast ? "broadcast" : "signal",
+		wakeups / rounds, (wakeups * 100 / rounds) % 100,
+		nwaiters, cvbenchlock->lk_nsleeps, ms);
+}
+
+int
+cvbench(int nargs, char **args)
+{
+	unsigned nwaiters = CVBENCH_WAITERS;
+	unsigned rounds = CVBENCH_ROUNDS;
+
+	if (nargs > 3) {
+		kprintf("Usage: sy6 [waiters [rounds]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		nwaiters = atoi(args[1]);
+	}
+	if (nargs > 2) {
+		rounds = atoi(args[2]);
+	}
+	if (nwaiters == 0 || nwaiters > NTHREADS || rounds == 0) {
+		kprintf("cvbench: 1 to %u waiters, at least one round\n",
+			NTHREADS);
+		return EINVAL;
+	}
+
+	inititems();
+	if (cvbenchlock == NULL) {
+		cvbenchlock = lock_create("cvbenchlock");
+		cvbenchcv = cv_create("cvbenchcv");
+		if (cvbenchlock == NULL || cvbenchcv == NULL) {
+			panic("cvbench: lock_create/cv_create failed\n");
+		}
+	}
+
+	kprintf("Starting CV benchmark: %u waiters, %u rounds...\n",
+		nwaiters, rounds);
+
+	cvbench_run(nwaiters, rounds, true);
+	cvbench_run(nwaiters, rounds, false);
+
+	kprintf("CV benchmark done.\n");
+	return 0;
+}
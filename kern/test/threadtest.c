@@ -31,7 +31,11 @@
  * Thread test code.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -144,3 +148,170 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Throughput test: runs batches of tt2-style compute-bound threads
+ * (which also yield, like those of tt3) with 1, N, 2N and 4N threads,
+ * N being the number of CPUs, and reports the work done per second and
+ * where the threads finished. Threads are all forked on this CPU, so
+ * anything that ends up elsewhere got there by being stolen. Run it
+ * with different "cpus" settings in sys161.conf to compare CPU counts.
+ */
+
+#define TT4_ROUNDS  20
+#define TT4_WORK    20000
+#define TT4_MAXCPUS 32
+
+static unsigned tt4_cpus[TT4_MAXCPUS];
+static struct spinlock tt4_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+busythread(void *junk, unsigned long num)
+{
+	volatile int i;
+	int r;
+
+	(void)junk;
+	(void)num;
+
+	for (r=0; r<TT4_ROUNDS; r++) {
+		for (i=0; i<TT4_WORK; i++);
+		thread_yield();
+	}
+
+	spinlock_acquire(&tt4_lock);
+	tt4_cpus[curcpu->c_number % TT4_MAXCPUS]++;
+	spinlock_release(&tt4_lock);
+
+	V(tsem);
+}
+
+static
+void
+runbusythreads(unsigned nthreads, unsigned numcpus)
+{
+	struct timespec start, end;
+	unsigned i, ms;
+	int result;
+
+	for (i=0; i<TT4_MAXCPUS; i++) {
+		tt4_cpus[i] = 0;
+	}
+
+	gettime(&start);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("threadtest4", NULL, busythread, NULL, i);
+		if (result) {
+			panic("threadtest: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(tsem);
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &end);
+	ms = end.tv_sec * 1000 + end.tv_nsec / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+
+	kprintf("%3u threads: %5u ms, %6u rounds/s, finished on cpus:",
+		nthreads, ms, nthreads * TT4_ROUNDS * 1000 / ms);
+	for (i=0; i<numcpus && i<TT4_MAXCPUS; i++) {
+		kprintf(" %u", tt4_cpus[i]);
+	}
+	kprintf("\n");
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	unsigned numcpus;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: tt4\n");
+		return EINVAL;
+	}
+
+	init_sem();
+	numcpus = cpu_count();
+	kprintf("Starting thread test 4 on %u cpus...\n", numcpus);
+	runbusythreads(1, numcpus);
+	runbusythreads(numcpus, numcpus);
+	runbusythreads(2 * numcpus, numcpus);
+	runbusythreads(4 * numcpus, numcpus);
+	kprintf("Thread test 4 done.\n");
+
+	return 0;
+}
+
+/*
+ * Thread creation test: forks batches of threads that exit right
+ * away, and reports how many threads were created and reaped per
+ * second. The threads go back to the thread cache when they are
+ * reaped, so after the first batch they should rarely need kmalloc.
+ */
+
+#define TT5_BATCH   32
+#define TT5_BATCHES 50
+
+static
+void
+quickthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(tsem);
+}
+
+int
+threadtest5(int nargs, char **args)
+{
+	struct timespec start, end;
+	unsigned i, j, ms;
+	int result;
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: tt5\n");
+		return EINVAL;
+	}
+
+	init_sem();
+	kprintf("Starting thread test 5...\n");
+
+	gettime(&start);
+	for (i=0; i<TT5_BATCHES; i++) {
+		for (j=0; j<TT5_BATCH; j++) {
+			result = thread_fork("threadtest5", NULL,
+					     quickthread, NULL, j);
+			if (result) {
+				panic("threadtest: thread_fork failed %s)\n",
+				      strerror(result));
+			}
+		}
+		for (j=0; j<TT5_BATCH; j++) {
+			P(tsem);
+		}
+	}
+	gettime(&end);
+
+	timespec_sub(&end, &start, &end);
+	ms = end.tv_sec * 1000 + end.tv_nsec / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+	kprintf("%u threads in %u ms: %u threads/s\n",
+		TT5_BATCH * TT5_BATCHES, ms,
+		TT5_BATCH * TT5_BATCHES * 1000 / ms);
+	kprintf("Thread test 5 done.\n");
+
+	return 0;
+}
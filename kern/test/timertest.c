@@ -0,0 +1,91 @@
+/*
+ * Timer tests.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <timer.h>
+#include <test.h>
+
+#define TMT_ROUNDS	10
+#define TMT_FAR		20000000000ULL	/* 20 s, beyond wheel level 1 */
+
+static const uint64_t tmt_intervals[] = {
+	100000,		/* 100 us, well below a hardclock */
+	1000000,	/* 1 ms */
+	5000000,	/* 5 ms */
+	50000000,	/* 50 ms */
+};
+
+/*
+ * Precision test: sleep for intervals shorter and longer than a
+ * hardclock, and report how late the wakeups are. Then check that
+ * P_timed times out on a semaphore nobody signals, and doesn't when
+ * the count is already up. Last, sleep once past the level 1 horizon
+ * of the timer wheel, so the timer has to be cascaded down twice.
+ */
+int
+timertest(int nargs, char **args)
+{
+	struct semaphore *sem;
+	uint64_t start, late, totlate, maxlate;
+	unsigned i, j;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timer precision test (%d rounds each)\n",
+		TMT_ROUNDS);
+	kprintf("   sleep (us)   avg late (us)   max late (us)\n");
+	for (i=0; i<sizeof(tmt_intervals)/sizeof(tmt_intervals[0]); i++) {
+		totlate = maxlate = 0;
+		for (j=0; j<TMT_ROUNDS; j++) {
+			start = timer_now();
+			timer_sleep(tmt_intervals[i]);
+			late = timer_now() - start;
+			if (late < tmt_intervals[i]) {
+				panic("timertest: woke up %llu ns early\n",
+				      tmt_intervals[i] - late);
+			}
+			late -= tmt_intervals[i];
+			totlate += late;
+			if (late > maxlate) {
+				maxlate = late;
+			}
+		}
+		kprintf("%13llu %15llu %15llu\n", tmt_intervals[i] / 1000,
+			totlate / TMT_ROUNDS / 1000, maxlate / 1000);
+	}
+
+	sem = sem_create("timertest", 0);
+	if (sem == NULL) {
+		return ENOMEM;
+	}
+	start = timer_now();
+	if (P_timed(sem, 2000000)) {
+		panic("timertest: P_timed succeeded on an empty semaphore\n");
+	}
+	if (timer_now() - start < 2000000) {
+		panic("timertest: P_timed timed out early\n");
+	}
+	V(sem);
+	if (!P_timed(sem, 2000000)) {
+		panic("timertest: P_timed timed out on a full semaphore\n");
+	}
+	sem_destroy(sem);
+
+	kprintf("Sleeping %llu s...\n", TMT_FAR / 1000000000);
+	start = timer_now();
+	timer_sleep(TMT_FAR);
+	late = timer_now() - start;
+	if (late < TMT_FAR) {
+		panic("timertest: woke up %llu ns early\n", TMT_FAR - late);
+	}
+	kprintf("Woke up %llu us late\n", (late - TMT_FAR) / 1000);
+
+	kprintf("Timer test done.\n");
+	return 0;
+}
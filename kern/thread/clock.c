@@ -29,29 +29,34 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
+#include <timer.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at specific points in the future are timers (timer.c);
+ * this file drives them from the timer interrupt, which it programs
+ * one event at a time rather than leaving it ticking at HZ.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
  */
 
 /*
- * Timing constants. These should be tuned along with any work done on
- * the scheduler.
+ * Hardclock period, and how long an idle cpu may go without a timer
+ * interrupt. An idle cpu has nothing to schedule: it only needs to
+ * wake up for its timers, or when another cpu sends it an interrupt.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
+#define HARDCLOCK_NSECS		(1000000000 / HZ)
+#define IDLE_MAX_NSECS		1000000000	/* one second */
+#define TIMER_MIN_NSECS		20000		/* don't bother for less */
 
 /*
  * Once a second, everything waiting on lbolt is awakened by CPU 0.
@@ -59,6 +64,12 @@
 static struct wchan *lbolt;
 static struct spinlock lbolt_lock;
 
+/*
+ * Threads in timer_sleep. Nobody wakes this but their own timeouts.
+ */
+static struct wchan *sleepers;
+static struct spinlock sleepers_lock;
+
 /*
  * Setup.
  */
@@ -70,6 +81,11 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	spinlock_init(&sleepers_lock);
+	sleepers = wchan_create("timer_sleep");
+	if (sleepers == NULL) {
+		panic("Couldn't create timer_sleep\n");
+	}
 }
 
 /*
@@ -86,24 +102,92 @@ timerclock(void)
 }
 
 /*
- * This is called HZ times a second (on each processor) by the timer
- * code.
+ * Set the timer interrupt of this cpu for the next thing it has to do:
+ * the next hardclock if the cpu is busy, or else its next timer.
+ */
+static
+void
+clock_program_at(uint64_t now)
+{
+	uint64_t next, limit;
+	int spl;
+
+	spl = splhigh();
+
+	if (curcpu->c_nexttick <= now) {
+		/* skip the hardclocks we slept through */
+		curcpu->c_nexttick = now + HARDCLOCK_NSECS;
+	}
+	limit = curcpu->c_isidle ? now + IDLE_MAX_NSECS : curcpu->c_nexttick;
+
+	next = timerwheel_next();
+	if (next > limit) {
+		next = limit;
+	}
+	if (next < now + TIMER_MIN_NSECS) {
+		next = now + TIMER_MIN_NSECS;
+	}
+
+	curcpu->c_nextevent = next;
+	mainbus_settimer(next - now);
+
+	splx(spl);
+}
+
+void
+clock_program(void)
+{
+	clock_program_at(timer_now());
+}
+
+/*
+ * This is called by the timer code, on each processor, HZ times a
+ * second while it is busy, and otherwise whenever one of its timers
+ * is due.
  */
 void
 hardclock(void)
 {
-	/*
-	 * Collect statistics here as desired.
-	 */
+	uint64_t now;
+	bool tick;
+
+	/* keep the cycle counter from wrapping around unseen */
+	(void)timer_cpu_now();
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
+	now = timer_now();
+	timerwheel_run(now);
+
+	tick = now >= curcpu->c_nexttick;
+	if (tick) {
+		curcpu->c_nexttick += HARDCLOCK_NSECS;
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+
+	/* before schedule(), which may switch threads */
+	clock_program_at(now);
+
+	if (tick) {
+		curcpu->c_hardclocks++;
 		schedule();
 	}
-	thread_yield();
+}
+
+/*
+ * Suspend execution for NSECS nanoseconds.
+ */
+void
+timer_sleep(uint64_t nsecs)
+{
+	uint64_t now, end;
+
+	now = timer_now();
+	end = now + nsecs;
+
+	spinlock_acquire(&sleepers_lock);
+	while (now < end) {
+		wchan_sleep_timeout(sleepers, &sleepers_lock, end - now);
+		now = timer_now();
+	}
+	spinlock_release(&sleepers_lock);
 }
 
 /*
@@ -112,10 +196,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		timer_sleep((uint64_t)num_secs * 1000000000);
 	}
-	spinlock_release(&lbolt_lock);
 }
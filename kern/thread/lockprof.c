@@ -0,0 +1,152 @@
+/*
+ * Lock contention profiler. See lockprof.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <lockprof.h>
+
+/*
+ * All profiles. Profiles are never freed, so once a profile is on the
+ * list it can be read without the lock.
+ */
+static struct lockprof *lockprof_list;
+static struct spinlock lockprof_listlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Make a profile for a lock called NAME. Returns NULL if out of
+ * memory, in which case the lock just goes unprofiled.
+ */
+struct lockprof *
+lockprof_create(const char *name)
+{
+	struct lockprof *lp;
+
+	lp = kmalloc(sizeof(*lp));
+	if (lp == NULL) {
+		return NULL;
+	}
+	lp->lp_name = kstrdup(name);
+	if (lp->lp_name == NULL) {
+		kfree(lp);
+		return NULL;
+	}
+	lp->lp_sleeplock = false;
+	lp->lp_acquires = 0;
+	lp->lp_contended = 0;
+	lp->lp_waittime = 0;
+	lp->lp_maxwait = 0;
+	lp->lp_holder = 0;
+	lp->lp_maxwaiter = 0;
+	lp->lp_maxblocker = 0;
+
+	spinlock_acquire(&lockprof_listlock);
+	lp->lp_next = lockprof_list;
+	lockprof_list = lp;
+	spinlock_release(&lockprof_listlock);
+
+	return lp;
+}
+
+void
+lockprof_attach_spinlock(struct spinlock *lk, struct lockprof *lp)
+{
+	lk->splk_prof = lp;
+}
+
+void
+lockprof_attach_lock(struct lock *lk, struct lockprof *lp)
+{
+	if (lp != NULL) {
+		lp->lp_sleeplock = true;
+	}
+	lk->lk_prof = lp;
+}
+
+/*
+ * Account for an acquisition of the lock, which the caller now holds,
+ * made at SITE after waiting WAIT (if WAITED).
+ */
+void
+lockprof_acquired(struct lockprof *lp, uint64_t wait, bool waited,
+		  vaddr_t site)
+{
+	lp->lp_acquires++;
+	if (waited) {
+		lp->lp_contended++;
+		lp->lp_waittime += wait;
+		if (wait > lp->lp_maxwait) {
+			lp->lp_maxwait = wait;
+			lp->lp_maxwaiter = site;
+			/* the previous holder, most likely what we waited for */
+			lp->lp_maxblocker = lp->lp_holder;
+		}
+	}
+	lp->lp_holder = site;
+}
+
+static
+void
+lockprof_printone(struct lockprof *lp)
+{
+	uint64_t avg;
+
+	avg = lp->lp_contended ? lp->lp_waittime / lp->lp_contended : 0;
+	kprintf("%-20s %10llu %9llu %3llu%% %12llu %10llu %10llu"
+		"  0x%08x 0x%08x\n",
+		lp->lp_name, lp->lp_acquires, lp->lp_contended,
+		lp->lp_acquires ? lp->lp_contended * 100 / lp->lp_acquires
+		: 0ULL,
+		lp->lp_waittime, avg, lp->lp_maxwait,
+		lp->lp_maxwaiter, lp->lp_maxblocker);
+}
+
+static
+void
+lockprof_printkind(bool sleeplock)
+{
+	struct lockprof *lp;
+
+	kprintf("%-20s %10s %9s %4s %12s %10s %10s  %-10s %-10s\n",
+		sleeplock ? "sleep lock (ns)" : "spinlock (cycles)",
+		"acquires", "contended", "", "wait total", "wait avg",
+		"wait max", "max waiter", "holder");
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		if (lp->lp_sleeplock == sleeplock) {
+			lockprof_printone(lp);
+		}
+	}
+}
+
+/*
+ * Print all the profiles. The numbers keep changing as we go, so they
+ * may not add up exactly.
+ */
+void
+lockprof_print(void)
+{
+	lockprof_printkind(false);
+	kprintf("\n");
+	lockprof_printkind(true);
+}
+
+/*
+ * Clear all the profiles. Done without the locks, so an acquisition
+ * racing with this may be lost or half counted.
+ */
+void
+lockprof_reset(void)
+{
+	struct lockprof *lp;
+
+	for (lp = lockprof_list; lp != NULL; lp = lp->lp_next) {
+		lp->lp_acquires = 0;
+		lp->lp_contended = 0;
+		lp->lp_waittime = 0;
+		lp->lp_maxwait = 0;
+		lp->lp_maxwaiter = 0;
+		lp->lp_maxblocker = 0;
+	}
+}
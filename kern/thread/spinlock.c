@@ -43,6 +43,9 @@
  * Spinlocks.
  */
 
+/* Spin iterations to wait per cpu ahead in line on a ticket lock. */
+#define SPINLOCK_TICKET_BACKOFF 50
+
 
 /*
  * Initialize spinlock.
@@ -51,10 +54,20 @@ void
 spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
+	spinlock_data_set(&splk->splk_next, 0);
+	splk->splk_ticket = false;
 	splk->splk_holder = NULL;
+	LOCKPROF_FIELDINIT(&splk->splk_prof);
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
+void
+spinlock_init_ticket(struct spinlock *splk)
+{
+	spinlock_init(splk);
+	splk->splk_ticket = true;
+}
+
 /*
  * Clean up spinlock.
  */
@@ -62,7 +75,76 @@ void
 spinlock_cleanup(struct spinlock *splk)
 {
 	KASSERT(splk->splk_holder == NULL);
-	KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	if (splk->splk_ticket) {
+		KASSERT(spinlock_data_get(&splk->splk_lock) ==
+			spinlock_data_get(&splk->splk_next));
+	}
+	else {
+		KASSERT(spinlock_data_get(&splk->splk_lock) == 0);
+	}
+}
+
+/*
+ * Get a test-and-set lock. Returns true if it was not free right
+ * away.
+ */
+static
+bool
+spinlock_tas_wait(struct spinlock *splk)
+{
+	bool waited = false;
+
+	while (1) {
+		/*
+		 * Do test-test-and-set, that is, read first before
+		 * doing test-and-set, to reduce bus contention.
+		 *
+		 * Test-and-set is a machine-level atomic operation
+		 * that writes 1 into the lock word and returns the
+		 * previous value. If that value was 0, the lock was
+		 * previously unheld and we now own it. If it was 1,
+		 * we don't.
+		 */
+		if (spinlock_data_get(&splk->splk_lock) != 0) {
+			waited = true;
+			continue;
+		}
+		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+			waited = true;
+			continue;
+		}
+		break;
+	}
+	return waited;
+}
+
+/*
+ * Wait for our turn on a ticket lock. Each cpu ahead of us in line
+ * will hold the lock for a while, so wait in proportion before
+ * looking again, rather than all reading the lock word in a tight
+ * loop while it stays the same. Returns true if it was not our turn
+ * right away.
+ */
+static
+bool
+spinlock_ticket_wait(struct spinlock *splk, spinlock_data_t ticket)
+{
+	spinlock_data_t serving;
+	volatile unsigned i;
+	bool waited = false;
+
+	while (1) {
+		serving = spinlock_data_get(&splk->splk_lock);
+		if (serving == ticket) {
+			break;
+		}
+		waited = true;
+		for (i = (ticket - serving) * SPINLOCK_TICKET_BACKOFF; i > 0;
+		     i--) {
+			/* nothing */
+		}
+	}
+	return waited;
 }
 
 /*
@@ -76,6 +158,8 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	uint32_t start;
+	bool waited;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -93,29 +177,21 @@ spinlock_acquire(struct spinlock *splk)
 		mycpu = NULL;
 	}
 
-	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
-			continue;
-		}
-		break;
+	start = LOCKPROF_CYCLES();
+	if (splk->splk_ticket) {
+		waited = spinlock_ticket_wait(splk,
+			spinlock_data_fetchinc(&splk->splk_next));
+	}
+	else {
+		waited = spinlock_tas_wait(splk);
 	}
 
 	membar_store_any();
 	splk->splk_holder = mycpu;
 
+	LOCKPROF_ACQUIRED(splk->splk_prof,
+			  (uint32_t)(LOCKPROF_CYCLES() - start), waited);
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
@@ -137,7 +213,14 @@ spinlock_release(struct spinlock *splk)
 
 	splk->splk_holder = NULL;
 	membar_any_store();
-	spinlock_data_set(&splk->splk_lock, 0);
+	if (splk->splk_ticket) {
+		/* only the holder writes this: next ticket, please */
+		spinlock_data_set(&splk->splk_lock,
+			spinlock_data_get(&splk->splk_lock) + 1);
+	}
+	else {
+		spinlock_data_set(&splk->splk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
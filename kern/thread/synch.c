@@ -36,34 +36,41 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
+#include <timer.h>
+#include <kmem_cache.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore),
+			       NULL, NULL);
+
 struct semaphore *
 sem_create(const char *name, unsigned initial_count)
 {
         struct semaphore *sem;
 
-        sem = kmalloc(sizeof(*sem));
+        sem = kmem_cache_alloc(&sem_cache);
         if (sem == NULL) {
                 return NULL;
         }
 
         sem->sem_name = kstrdup(name);
         if (sem->sem_name == NULL) {
-                kfree(sem);
+                kmem_cache_free(&sem_cache, sem);
                 return NULL;
         }
 
 	sem->sem_wchan = wchan_create(sem->sem_name);
 	if (sem->sem_wchan == NULL) {
 		kfree(sem->sem_name);
-		kfree(sem);
+		kmem_cache_free(&sem_cache, sem);
 		return NULL;
 	}
 
@@ -82,7 +89,7 @@ sem_destroy(struct semaphore *sem)
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
         kfree(sem->sem_name);
-        kfree(sem);
+        kmem_cache_free(&sem_cache, sem);
 }
 
 void
@@ -120,6 +127,32 @@ P(struct semaphore *sem)
 	spinlock_release(&sem->sem_lock);
 }
 
+bool
+P_timed(struct semaphore *sem, uint64_t nsecs)
+{
+	uint64_t now, end;
+
+	KASSERT(sem != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	now = timer_now();
+	end = now + nsecs;
+
+	spinlock_acquire(&sem->sem_lock);
+	while (sem->sem_count == 0) {
+		if (now >= end) {
+			spinlock_release(&sem->sem_lock);
+			return false;
+		}
+		wchan_sleep_timeout(sem->sem_wchan, &sem->sem_lock, end - now);
+		now = timer_now();
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+	return true;
+}
+
 void
 V(struct semaphore *sem)
 {
@@ -156,7 +189,17 @@ lock_create(const char *name)
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
 
-        // add stuff here as needed
+	lock->lk_wchan = wchan_create(lock->lk_name);
+	if (lock->lk_wchan == NULL) {
+		kfree(lock->lk_name);
+		kfree(lock);
+		return NULL;
+	}
+
+	spinlock_init(&lock->lk_lock);
+	lock->lk_holder = NULL;
+	lock->lk_nsleeps = 0;
+	LOCKPROF_FIELDINIT(&lock->lk_prof);
 
         return lock;
 }
@@ -165,46 +208,115 @@ void
 lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+	KASSERT(lock->lk_holder == NULL);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
         kfree(lock->lk_name);
         kfree(lock);
 }
 
+/*
+ * Check if the holder of the lock is running on another CPU, in which
+ * case it is likely to release the lock soon. Call with lk_lock held:
+ * this keeps the holder from releasing the lock (and possibly exiting)
+ * under us.
+ */
+static
+bool
+lock_holder_running(struct lock *lock)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock->lk_lock));
+
+	holder = lock->lk_holder;
+	return holder != NULL && holder->t_state == S_RUN &&
+		holder->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
-	/* Call this (atomically) before waiting for a lock */
-	//HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	unsigned spins;
+	uint64_t start;
+	bool waited;
+
+	KASSERT(lock != NULL);
 
-        // Write this
+	/* May not block in an interrupt handler. */
+	KASSERT(curthread->t_in_interrupt == false);
 
-        (void)lock;  // suppress warning until code gets written
+	spinlock_acquire(&lock->lk_lock);
+
+	/* Call this (atomically) before waiting for a lock */
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+
+	KASSERT(lock->lk_holder != curthread);
+
+	spins = 0;
+	start = 0;
+	waited = false;
+	while (lock->lk_holder != NULL) {
+		if (!waited) {
+			/* only look at the clock if we have to wait */
+			waited = true;
+			start = LOCKPROF_NSECS(lock->lk_prof);
+		}
+		if (spins < LOCK_SPIN_MAX && lock_holder_running(lock)) {
+			/*
+			 * The holder is busy on another CPU: going to
+			 * sleep and being woken up again costs more
+			 * than waiting for it a little while. Spin
+			 * without the spinlock so the holder can get it
+			 * to release the lock.
+			 */
+			spinlock_release(&lock->lk_lock);
+			while (lock->lk_holder != NULL && spins < LOCK_SPIN_MAX) {
+				spins++;
+			}
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		lock->lk_nsleeps++;
+		wchan_sleep(lock->lk_wchan, &lock->lk_lock);
+	}
+	lock->lk_holder = curthread;
+	LOCKPROF_ACQUIRED(lock->lk_prof,
+			  waited ? LOCKPROF_NSECS(lock->lk_prof) - start : 0, waited);
 
 	/* Call this (atomically) once the lock is acquired */
-	//HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+
+	spinlock_release(&lock->lk_lock);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&lock->lk_lock);
+
+	lock->lk_holder = NULL;
+
 	/* Call this (atomically) when the lock is released */
-	//HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
 
-        // Write this
+	wchan_wakeone(lock->lk_wchan, &lock->lk_lock);
 
-        (void)lock;  // suppress warning until code gets written
+	spinlock_release(&lock->lk_lock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-        // Write this
+	KASSERT(lock != NULL);
 
-        (void)lock;  // suppress warning until code gets written
-
-        return true; // dummy until code gets written
+	/* only curthread can make this become true or false */
+	return lock->lk_holder == curthread;
 }
 
 ////////////////////////////////////////////////////////////
@@ -228,7 +340,14 @@ cv_create(const char *name)
                 return NULL;
         }
 
-        // add stuff here as needed
+	cv->cv_wchan = wchan_create(cv->cv_name);
+	if (cv->cv_wchan == NULL) {
+		kfree(cv->cv_name);
+		kfree(cv);
+		return NULL;
+	}
+
+	spinlock_init(&cv->cv_lock);
 
         return cv;
 }
@@ -238,8 +357,9 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&cv->cv_lock);
+	wchan_destroy(cv->cv_wchan);
         kfree(cv->cv_name);
         kfree(cv);
 }
@@ -247,23 +367,256 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
-        // Write this
-        (void)cv;    // suppress warning until code gets written
-        (void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	/*
+	 * Get on the channel before letting go of the lock, so that
+	 * a signal sent as soon as the lock is free is not missed.
+	 */
+	spinlock_acquire(&cv->cv_lock);
+	lock_release(lock);
+	wchan_sleep(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
+
+	/*
+	 * If we were moved by cv_broadcast, it was lock_release that
+	 * woke us up; either way, we still have to compete for it.
+	 */
+	lock_acquire(lock);
 }
 
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
-        // Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	spinlock_acquire(&cv->cv_lock);
+	wchan_wakeone(cv->cv_wchan, &cv->cv_lock);
+	spinlock_release(&cv->cv_lock);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	KASSERT(cv != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	/*
+	 * We hold the lock, so none of the waiters could get it if we
+	 * woke them now. Requeue them on the lock instead: each
+	 * lock_release will then wake exactly one of them.
+	 */
+	spinlock_acquire(&cv->cv_lock);
+	spinlock_acquire(&lock->lk_lock);
+	wchan_transferall(cv->cv_wchan, &cv->cv_lock,
+			  lock->lk_wchan, &lock->lk_lock);
+	spinlock_release(&lock->lk_lock);
+	spinlock_release(&cv->cv_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+	unsigned i;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_rwchan = wchan_create(rw->rw_name);
+	if (rw->rw_rwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_wwchan = wchan_create(rw->rw_name);
+	if (rw->rw_wwchan == NULL) {
+		wchan_destroy(rw->rw_rwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	rw->rw_wwaiting = 0;
+	for (i=0; i<RWLOCK_MAXCPUS; i++) {
+		spinlock_init(&rw->rw_cpus[i].rc_lock);
+		rw->rw_cpus[i].rc_readers = 0;
+	}
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	unsigned i;
+	int readers = 0;
+
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == NULL);
+
+	for (i=0; i<RWLOCK_MAXCPUS; i++) {
+		readers += rw->rw_cpus[i].rc_readers;
+		spinlock_cleanup(&rw->rw_cpus[i].rc_lock);
+	}
+	KASSERT(readers == 0);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_wwchan);
+	wchan_destroy(rw->rw_rwchan);
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+/*
+ * Get the reader counter for the current CPU. If we migrate right
+ * after looking at curcpu we just end up using another CPU's counter,
+ * which is slower but still correct.
+ */
+static
+struct rwlock_cpu *
+rwlock_mycpu(struct rwlock *rw)
+{
+	return &rw->rw_cpus[curcpu->c_number % RWLOCK_MAXCPUS];
+}
+
+/*
+ * Count the readers holding the lock. Call with rw_lock held, after
+ * having announced a writer: readers that come along afterwards see
+ * it and don't take the lock.
+ */
+static
+int
+rwlock_readers(struct rwlock *rw)
+{
+	unsigned i;
+	int readers = 0;
+
+	KASSERT(spinlock_do_i_hold(&rw->rw_lock));
+
+	for (i=0; i<RWLOCK_MAXCPUS; i++) {
+		spinlock_acquire(&rw->rw_cpus[i].rc_lock);
+		readers += rw->rw_cpus[i].rc_readers;
+		spinlock_release(&rw->rw_cpus[i].rc_lock);
+	}
+	KASSERT(readers >= 0);
+	return readers;
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/*
+	 * Fast path: no writer around, just bump our counter. Checking
+	 * for writers under the counter's spinlock guarantees that a
+	 * writer either sees our count or we see the writer.
+	 */
+	rc = rwlock_mycpu(rw);
+	spinlock_acquire(&rc->rc_lock);
+	if (rw->rw_writer == NULL && rw->rw_wwaiting == 0) {
+		rc->rc_readers++;
+		spinlock_release(&rc->rc_lock);
+		return;
+	}
+	spinlock_release(&rc->rc_lock);
+
+	/* Slow path: wait for the writers to be done. */
+	spinlock_acquire(&rw->rw_lock);
+	while (rw->rw_writer != NULL || rw->rw_wwaiting > 0) {
+		wchan_sleep(rw->rw_rwchan, &rw->rw_lock);
+	}
+	rc = rwlock_mycpu(rw);
+	spinlock_acquire(&rc->rc_lock);
+	rc->rc_readers++;
+	spinlock_release(&rc->rc_lock);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+	bool writers;
+
+	KASSERT(rw != NULL);
+
+	rc = rwlock_mycpu(rw);
+	spinlock_acquire(&rc->rc_lock);
+	rc->rc_readers--;
+	writers = rw->rw_writer != NULL || rw->rw_wwaiting > 0;
+	spinlock_release(&rc->rc_lock);
+
+	if (writers) {
+		/* we may be the last reader a writer is waiting for */
+		spinlock_acquire(&rw->rw_lock);
+		wchan_wakeall(rw->rw_wwchan, &rw->rw_lock);
+		spinlock_release(&rw->rw_lock);
+	}
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+
+	/* from here on, new readers hold back */
+	rw->rw_wwaiting++;
+	while (rw->rw_writer != NULL) {
+		wchan_sleep(rw->rw_wwchan, &rw->rw_lock);
+	}
+	rw->rw_writer = curthread;
+	rw->rw_wwaiting--;
+
+	/* wait for the readers already in to drain */
+	while (rwlock_readers(rw) > 0) {
+		wchan_sleep(rw->rw_wwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+
+	/* writer preference: let the readers in only if nobody else writes */
+	if (rw->rw_wwaiting > 0) {
+		wchan_wakeall(rw->rw_wwchan, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeall(rw->rw_rwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
 }
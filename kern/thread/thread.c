@@ -51,12 +51,24 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <vnode.h>
-#include "opt-waitpid.h"
+#include <clock.h>
+#include <timer.h>
+#include <kmem_cache.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Max number of destroyed threads each cpu keeps for reuse. The cache
+ * is never trimmed, so its stacks are memory held for good: keep it
+ * small, RAM can be as little as 512K.
+ */
+#define THREAD_CACHE_MAX 4
+
+/* Max number of CPUs ipi_tlbshootdown_sync can track (one bit each). */
+#define SHOOTDOWN_MAXCPUS 32
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -110,9 +122,53 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Per-cpu cache of destroyed threads, kept with their stack (and its
+ * guard band) so that creating a thread doesn't have to allocate a
+ * struct thread and a STACK_SIZE stack every time. The cache is only
+ * touched by its own cpu, with interrupts off.
+ */
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct thread *thread;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* creating the boot cpu */
+		return NULL;
+	}
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	return thread;
+}
+
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	bool ret;
+	int spl;
+
+	spl = splhigh();
+	ret = curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (ret) {
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+	}
+	splx(spl);
+
+	return ret;
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
+ *
+ * A thread taken from the cache already has a stack.
  */
 static
 struct thread *
@@ -122,23 +178,30 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = thread_cache_get();
 	if (thread == NULL) {
-		return NULL;
+		thread = kmalloc(sizeof(*thread));
+		if (thread == NULL) {
+			return NULL;
+		}
+		thread->t_stack = NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
+		if (thread->t_stack != NULL) {
+			kfree(thread->t_stack);
+		}
 		kfree(thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
+	thread->t_wchan = NULL;
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -150,6 +213,18 @@ thread_create(const char *name)
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
 	/* If you add to struct thread, be sure to initialize here */
+	thread->t_uslot = 0;
+
+	/* new threads start at the top */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+
+	/* t_mark is set when the thread is first switched to */
+	thread->t_mark = 0;
+	thread->t_utime = 0;
+	thread->t_stime = 0;
+	thread->t_ucharged = 0;
+	thread->t_scharged = 0;
 
 	return thread;
 }
@@ -179,15 +254,35 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
+	c->c_nready = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
+	c->c_timers = timerwheel_create();
+	if (c->c_timers == NULL) {
+		panic("cpu_create: couldn't create timer wheel\n");
+	}
+	c->c_nexttick = 0;
+	c->c_nextevent = 0;
+	c->c_cyclelast = 0;
+	c->c_cyclerem = 0;
+	c->c_cpuns = 0;
+
+	c->c_utime = 0;
+	c->c_stime = 0;
+	c->c_schedtime = 0;
+	c->c_idletime = 0;
+
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_all = false;
+	c->c_shootdown_gen = 0;
+	c->c_tlb_as = NULL;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -195,6 +290,9 @@ cpu_create(unsigned hardware_number)
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
 
+	snprintf(namebuf, sizeof(namebuf), "cpu%u runqueue", c->c_number);
+	LOCKPROF_SPINLOCK(&c->c_runqueue_lock, namebuf);
+
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
 	if (c->c_curthread == NULL) {
@@ -211,7 +309,7 @@ cpu_create(unsigned hardware_number)
 		 */
 		/*c->c_curthread->t_stack = ... */
 	}
-	else {
+	else if (c->c_curthread->t_stack == NULL) {
 		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
@@ -254,6 +352,15 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Return the number of CPUs that have been created.
+ */
+unsigned
+cpu_count(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
 /*
  * Destroy a thread.
  *
@@ -276,9 +383,6 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -286,6 +390,16 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
+	thread->t_name = NULL;
+
+	if (thread->t_stack != NULL) {
+		/* keep the thread and its stack for the next one */
+		thread_checkstack(thread);
+		if (thread_cache_put(thread)) {
+			return;
+		}
+		kfree(thread->t_stack);
+	}
 	kfree(thread);
 }
 
@@ -333,6 +447,7 @@ thread_panic(void)
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
 	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	curcpu->c_nready = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -444,6 +559,190 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put a thread on the run queue of cpu C, which must be locked.
+ *
+ * The run queue is kept sorted by priority, and FIFO within each
+ * priority, so the next thread to run is always at the head. Search
+ * from the tail: most threads end up there or close to it.
+ */
+static
+void
+thread_runqueue_add(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	tln = c->c_runqueue.tl_tail.tln_prev;
+	while (tln->tln_self != NULL &&
+	       tln->tln_self->t_priority > t->t_priority) {
+		tln = tln->tln_prev;
+	}
+	if (tln->tln_self == NULL) {
+		threadlist_addhead(&c->c_runqueue, t);
+	}
+	else {
+		threadlist_insertafter(&c->c_runqueue, tln->tln_self, t);
+	}
+	c->c_nready = c->c_runqueue.tl_count;
+}
+
+/*
+ * Work stealing: called by an idle cpu, with its run queue unlocked.
+ * Pick the cpu with the most ready threads, going by the unlocked
+ * c_nready counters so that looking costs nothing to the busy cpus,
+ * and move its last ready thread (lowest priority, and least likely
+ * to have a warm cache there) to our run queue.
+ *
+ * Returns true if a thread was stolen.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct cpu *c, *busiest;
+	struct threadlistnode *tln;
+	struct thread *t;
+	unsigned i, numcpus, n, max;
+
+	busiest = NULL;
+	max = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		n = c->c_nready;
+		if (n > max) {
+			max = n;
+			busiest = c;
+		}
+	}
+	if (busiest == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&busiest->c_runqueue_lock);
+	t = NULL;
+	for (tln = busiest->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_self != NULL; tln = tln->tln_prev) {
+		/*
+		 * If the other cpu is idle, its curthread may be on
+		 * its run queue while the idle loop still runs on its
+		 * stack; taking it would be fatal. (See also the
+		 * notes in thread_switch.)
+		 */
+		if (tln->tln_self != busiest->c_curthread) {
+			t = tln->tln_self;
+			break;
+		}
+	}
+	if (t != NULL) {
+		threadlist_remove(&busiest->c_runqueue, t);
+		busiest->c_nready = busiest->c_runqueue.tl_count;
+		t->t_cpu = curcpu->c_self;
+	}
+	spinlock_release(&busiest->c_runqueue_lock);
+
+	if (t == NULL) {
+		return false;
+	}
+
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+	      t->t_name, busiest->c_number, curcpu->c_number);
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	thread_runqueue_add(curcpu->c_self, t);
+	spinlock_release(&curcpu->c_runqueue_lock);
+	return true;
+}
+
+/*
+ * CPU time accounting, in nanoseconds of timer_cpu_now(). That clock
+ * is local to each cpu, but an interval never spans two: t_mark is
+ * set when the thread is switched to, and the thread cannot move to
+ * another cpu until it is switched out again. Called with interrupts
+ * off.
+ *
+ * Before timer_bootstrap the clock reads 0, so boot-time intervals
+ * are not charged, and a thread whose t_mark is still 0 starts its
+ * first interval at the next call.
+ */
+uint64_t
+thread_charge(bool user)
+{
+	struct thread *cur = curthread;
+	uint64_t now, delta;
+
+	now = timer_cpu_now();
+	if (now == 0 || cur->t_mark == 0) {
+		/*
+		 * Too early in boot to tell the time, or the boot
+		 * thread of a cpu was never switched to: start its
+		 * first interval now.
+		 */
+		delta = 0;
+	}
+	else {
+		delta = now - cur->t_mark;
+	}
+	cur->t_mark = now;
+
+	if (user) {
+		cur->t_utime += delta;
+		curcpu->c_utime += delta;
+	}
+	else {
+		cur->t_stime += delta;
+		curcpu->c_stime += delta;
+	}
+	return now;
+}
+
+/*
+ * Print where the time of each cpu went, in milliseconds.
+ */
+void
+cpu_printtimes(void)
+{
+	struct cpu *c;
+	unsigned i, n;
+
+	kprintf("cpu      user ms       sys ms     sched ms      idle ms\n");
+	n = cpuarray_num(&allcpus);
+	for (i=0; i<n; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf("%3u %12llu %12llu %12llu %12llu\n", c->c_number,
+			c->c_utime / 1000000, c->c_stime / 1000000,
+			c->c_schedtime / 1000000, c->c_idletime / 1000000);
+	}
+}
+
+/*
+ * Wake up some idle cpu other than BUSY, so it steals from the busy
+ * cpus. Like thread_steal this looks at c_isidle without locking:
+ * the worst that can happen is a useless interrupt or a missed one,
+ * and in the latter case the thread just runs a bit later.
+ */
+static
+void
+thread_kick_idle(struct cpu *busy)
+{
+	struct cpu *c;
+	unsigned i, n;
+
+	n = cpuarray_num(&allcpus);
+	for (i=0; i<n; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busy && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -468,7 +767,7 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	thread_runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
 		/*
@@ -477,6 +776,14 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (targetcpu->c_nready > 1) {
+		/*
+		 * More work than the cpu can do right away. Idle cpus
+		 * no longer wake up every hardclock to look for work
+		 * to steal, so kick one.
+		 */
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -507,13 +814,15 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	/* Allocate a stack, unless the thread came with one */
 	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -564,6 +873,8 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	uint64_t start, idlestart, end;
+	bool idled;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -596,6 +907,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		return;
 	}
 
+	/* From here until the next thread runs is scheduler time */
+	start = thread_charge(false);
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
@@ -604,7 +918,17 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		/*
+		 * Giving up the CPU before the end of the time slice
+		 * earns a better priority: this keeps threads that
+		 * mostly wait for I/O responsive.
+		 */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+		}
+		cur->t_ticks = 0;
 		cur->t_wchan_name = wc->wc_name;
+		cur->t_wchan = wc;
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -640,17 +964,53 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
+	/*
+	 * Before actually idling, try to steal a thread from a busier
+	 * cpu. An idle cpu doesn't get hardclocks: it comes back here
+	 * for its own timers, when a thread is made runnable on it, or
+	 * when a busy cpu kicks it to come and steal.
+	 *
+	 * Once it has work again, the cpu needs its hardclock back to
+	 * schedule; reprogram the timer (with the runqueue unlocked,
+	 * as the timer code doesn't nest inside it).
+	 */
+
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	idled = false;
+	idlestart = 0;
 	do {
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!thread_steal()) {
+				if (!idled) {
+					idlestart = timer_cpu_now();
+					clock_program();
+					idled = true;
+				}
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
+	curcpu->c_nready = curcpu->c_runqueue.tl_count;
 	curcpu->c_isidle = false;
+	if (idled) {
+		spinlock_release(&curcpu->c_runqueue_lock);
+		clock_program();
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+	}
+
+	end = timer_cpu_now();
+	if (idled) {
+		curcpu->c_schedtime += idlestart - start;
+		curcpu->c_idletime += end - idlestart;
+	}
+	else {
+		curcpu->c_schedtime += end - start;
+	}
+	next->t_mark = end;
 
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
@@ -784,15 +1144,10 @@ thread_exit(void)
 
 	cur = curthread;
 
-#if !OPT_WAITPID
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process, unless _exit or thread_exit already
+	 * did (they have to, before letting a waiter destroy it).
 	 */
-	proc_remthread(cur);
-#endif
-
-	/* Make sure we *are* detached (move this only if you're sure!) */
 	if(cur->t_proc != NULL)	proc_remthread(cur);
 
 	KASSERT(cur->t_proc == NULL);
@@ -820,139 +1175,79 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Multilevel feedback queue. Each thread has a priority level, from 0
+ * (highest) to SCHED_NPRIO-1, and the run queue is kept sorted by it
+ * (see thread_runqueue_add). A thread at level L can run for
+ * SCHED_QUANTUM(L) hardclocks before being preempted: if it uses up
+ * the whole slice it is CPU-bound and drops one level, while a thread
+ * that goes to sleep moves up one (see thread_switch). A thread is also
+ * preempted as soon as a thread with a better priority is ready.
+ *
+ * So that the threads at the bottom are not starved, every
+ * SCHED_BOOST_HARDCLOCKS all the threads of the CPU go back to the top.
  */
+#define SCHED_NPRIO		4
+#define SCHED_QUANTUM(prio)	(1U << (prio))	/* in hardclocks */
+#define SCHED_BOOST_HARDCLOCKS	HZ		/* once a second */
 
+/*
+ * Move all the threads on this CPU back to the top level. Since they
+ * all end up with the same priority, the run queue stays sorted.
+ */
+static
 void
-schedule(void)
+schedule_boost(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct threadlistnode *tln;
+	struct threadlist *rq = &curcpu->c_runqueue;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (tln = rq->tl_head.tln_next; tln->tln_self != NULL;
+	     tln = tln->tln_next) {
+		tln->tln_self->t_priority = 0;
+		tln->tln_self->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	curthread->t_priority = 0;
+	curthread->t_ticks = 0;
 }
 
-/*
- * Thread migration.
- *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
- *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
- *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
- */
 void
-thread_consider_migration(void)
+schedule(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	struct thread *cur = curthread;
+	struct thread *next;
+	bool preempt;
 
-	my_count = total_count = 0;
-	numcpus = cpuarray_num(&allcpus);
-	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
+	if ((curcpu->c_hardclocks % SCHED_BOOST_HARDCLOCKS) == 0) {
+		schedule_boost();
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
+	/* Nothing to charge if the CPU was idle. */
+	if (curcpu->c_isidle) {
 		return;
 	}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
-	spinlock_release(&curcpu->c_runqueue_lock);
-
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		/* used its whole slice: demote, and let the others run */
+		if (cur->t_priority < SCHED_NPRIO - 1) {
+			cur->t_priority++;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		cur->t_ticks = 0;
+		thread_yield();
+		return;
 	}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
-	}
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	next = curcpu->c_runqueue.tl_head.tln_next->tln_self;
+	preempt = next != NULL && next->t_priority < cur->t_priority;
+	spinlock_release(&curcpu->c_runqueue_lock);
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	if (preempt) {
+		thread_yield();
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -961,6 +1256,33 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+/*
+ * Wait channels come from a cache of their own, where they are kept
+ * with their (empty) thread list initialized.
+ */
+static
+int
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_init(&wc->wc_threads);
+	return 0;
+}
+
+static
+void
+wchan_dtor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_cleanup(&wc->wc_threads);
+}
+
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan),
+			       wchan_ctor, wchan_dtor);
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -974,11 +1296,10 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 
 	return wc;
@@ -991,8 +1312,8 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
-	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
+	kmem_cache_free(&wchan_cache, wc);
 }
 
 /*
@@ -1018,6 +1339,67 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 	spinlock_acquire(lk);
 }
 
+/*
+ * Timeout of wchan_sleep_timeout. The sleeper waits for done to be
+ * set before its stack frame, and this structure, goes away.
+ */
+struct wchan_timeout {
+	struct timer wt_timer;
+	struct thread *wt_thread;
+	struct wchan *wt_wchan;
+	struct spinlock *wt_lock;
+	volatile bool wt_timedout;
+	volatile bool wt_done;
+};
+
+static
+void
+wchan_timeout(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct thread *target = wt->wt_thread;
+
+	spinlock_acquire(wt->wt_lock);
+	if (target->t_wchan == wt->wt_wchan) {
+		/* still asleep: wake it ourselves */
+		threadlist_remove(&wt->wt_wchan->wc_threads, target);
+		target->t_wchan = NULL;
+		wt->wt_timedout = true;
+		thread_make_runnable(target, false);
+	}
+	wt->wt_done = true;
+	spinlock_release(wt->wt_lock);
+}
+
+/*
+ * Like wchan_sleep, but give up after NSECS nanoseconds. Returns true
+ * if the thread was woken up by the timeout rather than by a wakeup.
+ */
+bool
+wchan_sleep_timeout(struct wchan *wc, struct spinlock *lk, uint64_t nsecs)
+{
+	struct wchan_timeout wt;
+
+	wt.wt_thread = curthread;
+	wt.wt_wchan = wc;
+	wt.wt_lock = lk;
+	wt.wt_timedout = false;
+	wt.wt_done = false;
+	timer_init(&wt.wt_timer, wchan_timeout, &wt);
+	timer_add(&wt.wt_timer, timer_now() + nsecs);
+
+	wchan_sleep(wc, lk);
+
+	if (!timer_cancel(&wt.wt_timer)) {
+		/* the timeout is running on some cpu: let it finish */
+		while (!wt.wt_done) {
+			spinlock_release(lk);
+			spinlock_acquire(lk);
+		}
+	}
+	return wt.wt_timedout;
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1035,6 +1417,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 		/* Nobody was sleeping. */
 		return;
 	}
+	target->t_wchan = NULL;
 
 	/*
 	 * Note that thread_make_runnable acquires a runqueue lock
@@ -1065,6 +1448,7 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * private list.
 	 */
 	while ((target = threadlist_remhead(&wc->wc_threads)) != NULL) {
+		target->t_wchan = NULL;
 		threadlist_addtail(&list, target);
 	}
 
@@ -1080,6 +1464,26 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move all the threads sleeping on FROM to TO, without waking them.
+ * They will be woken by whoever wakes TO, and will then relock the
+ * spinlock they went to sleep with.
+ */
+void
+wchan_transferall(struct wchan *from, struct spinlock *fromlk,
+		  struct wchan *to, struct spinlock *tolk)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan = to;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1133,32 +1537,41 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Queue a TLB shootdown on the specified CPU. Call with its IPI lock
+ * held. If the queue is full, coalesce everything into a full flush.
  */
+static
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+tlbshootdown_queue(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	unsigned n;
 
-	spinlock_acquire(&target->c_ipi_lock);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
+
+	if (target->c_shootdown_all) {
+		return;
+	}
 
 	n = target->c_numshootdown;
 	if (n == TLBSHOOTDOWN_MAX) {
-		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
-		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+		target->c_shootdown_all = true;
+		target->c_numshootdown = 0;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+}
+
+/*
+ * Send a TLB shootdown IPI to the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+
+	tlbshootdown_queue(target, mapping);
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
@@ -1166,6 +1579,82 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a batch of TLB shootdowns and wait for them to complete.
+ *
+ * Each request only goes to the CPUs that have its address space
+ * active (all of them, for kernel mappings, whose ts_as is NULL), and
+ * each target CPU gets at most one IPI for the whole batch. The
+ * caller must not hold spinlocks: the targets may be waiting on us in
+ * the same way, and we need to be able to take their IPIs meanwhile.
+ *
+ * The current CPU does its part itself, when the loop gets to it. As
+ * we may move to another CPU at any time, it is checked with
+ * interrupts off that we are still on the CPU being looked at; a CPU
+ * we move to later gets its part when the loop gets to it (or got
+ * it already, by IPI).
+ */
+void
+ipi_tlbshootdown_sync(const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned gen[SHOOTDOWN_MAXCPUS];
+	uint32_t targets;
+	unsigned i, j, numcpus;
+	struct cpu *c;
+	bool done;
+	int spl;
+
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	numcpus = cpuarray_num(&allcpus);
+	KASSERT(numcpus <= SHOOTDOWN_MAXCPUS);
+	targets = 0;
+
+	for (i=0; i < numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+
+		spl = splhigh();
+		if (c == curcpu->c_self) {
+			for (j=0; j<n; j++) {
+				if (mappings[j].ts_as == NULL ||
+				    mappings[j].ts_as == c->c_tlb_as) {
+					vm_tlbshootdown(&mappings[j]);
+				}
+			}
+			splx(spl);
+			continue;
+		}
+		splx(spl);
+
+		spinlock_acquire(&c->c_ipi_lock);
+		for (j=0; j<n; j++) {
+			if (mappings[j].ts_as == NULL ||
+			    mappings[j].ts_as == c->c_tlb_as) {
+				tlbshootdown_queue(c, &mappings[j]);
+				targets |= (uint32_t)1 << i;
+			}
+		}
+		if (targets & ((uint32_t)1 << i)) {
+			gen[i] = c->c_shootdown_gen;
+			c->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+			mainbus_send_ipi(c);
+		}
+		spinlock_release(&c->c_ipi_lock);
+	}
+
+	for (i=0; i < numcpus; i++) {
+		if ((targets & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		c = cpuarray_get(&allcpus, i);
+		do {
+			spinlock_acquire(&c->c_ipi_lock);
+			done = c->c_shootdown_gen != gen[i];
+			spinlock_release(&c->c_ipi_lock);
+		} while (!done);
+	}
+}
+
 /*
  * Handle an incoming interprocessor interrupt.
  */
@@ -1207,10 +1696,17 @@ interprocessor_interrupt(void)
 		 * need to release the ipi lock while calling
 		 * vm_tlbshootdown.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		if (curcpu->c_shootdown_all) {
+			vm_tlbshootdown_all();
+		}
+		else {
+			for (i=0; i<curcpu->c_numshootdown; i++) {
+				vm_tlbshootdown(&curcpu->c_shootdown[i]);
+			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_all = false;
+		curcpu->c_shootdown_gen++;
 	}
 
 	curcpu->c_ipi_pending = 0;
@@ -0,0 +1,367 @@
+/*
+ * One-shot kernel timers, on a per-CPU hierarchical timer wheel.
+ * See timer.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <clock.h>
+#include <current.h>
+#include <timer.h>
+
+#define TW_SHIFT	20	/* level 0 slot: 2^20 ns, about 1 ms */
+#define TW_L0_BITS	8	/* level 0 covers about 268 ms */
+#define TW_L1_BITS	6	/* level 1 covers about 17 s */
+#define TW_L0_SIZE	(1U << TW_L0_BITS)
+#define TW_L1_SIZE	(1U << TW_L1_BITS)
+#define TW_L0_MASK	(TW_L0_SIZE - 1)
+#define TW_L1_MASK	(TW_L1_SIZE - 1)
+
+#define CALIBRATE_NSECS	10000000	/* 10 ms */
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	uint64_t tw_clock;		/* current level 0 slot, in 2^TW_SHIFT ns */
+	unsigned tw_count;		/* pending timers */
+	struct timer *tw_l0[TW_L0_SIZE];
+	struct timer *tw_l1[TW_L1_SIZE];
+	struct timer *tw_far;		/* beyond level 1 */
+};
+
+uint64_t
+timer_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Cycle counter rate, measured against the real-time clock once it
+ * has been attached (0 until then). All cpus run off the same clock.
+ */
+static uint32_t timer_cycles_per_ms;
+
+void
+timer_bootstrap(void)
+{
+	uint32_t c0;
+	uint64_t t0, t;
+	int spl;
+
+	KASSERT(timer_cycles_per_ms == 0);
+
+	spl = splhigh();
+	c0 = cpu_cycles();
+	t0 = timer_now();
+	do {
+		t = timer_now();
+	} while (t - t0 < CALIBRATE_NSECS);
+	timer_cycles_per_ms = (uint64_t)(cpu_cycles() - c0) * 1000000
+		/ (t - t0);
+	splx(spl);
+
+	KASSERT(timer_cycles_per_ms > 0);
+}
+
+/*
+ * The counter is only 32 bits, so each reading adds the cycles since
+ * the last one to a 64-bit count of nanoseconds, carrying the part of
+ * a nanosecond left over. This is right as long as the counter does
+ * not go all the way around between two readings; hardclock reads it
+ * at least once a second.
+ */
+uint64_t
+timer_cpu_now(void)
+{
+	uint32_t now;
+	uint64_t scaled;
+
+	if (timer_cycles_per_ms == 0) {
+		/* too early to tell */
+		return 0;
+	}
+
+	now = cpu_cycles();
+	scaled = (uint64_t)(now - curcpu->c_cyclelast) * 1000000
+		+ curcpu->c_cyclerem;
+	curcpu->c_cyclelast = now;
+	curcpu->c_cpuns += scaled / timer_cycles_per_ms;
+	curcpu->c_cyclerem = scaled % timer_cycles_per_ms;
+	return curcpu->c_cpuns;
+}
+
+struct timerwheel *
+timerwheel_create(void)
+{
+	struct timerwheel *tw;
+	unsigned i;
+
+	tw = kmalloc(sizeof(*tw));
+	if (tw == NULL) {
+		return NULL;
+	}
+	spinlock_init(&tw->tw_lock);
+	tw->tw_clock = 0;
+	tw->tw_count = 0;
+	for (i=0; i<TW_L0_SIZE; i++) {
+		tw->tw_l0[i] = NULL;
+	}
+	for (i=0; i<TW_L1_SIZE; i++) {
+		tw->tw_l1[i] = NULL;
+	}
+	tw->tw_far = NULL;
+	return tw;
+}
+
+static
+void
+tw_link(struct timer **head, struct timer *t)
+{
+	t->tm_next = *head;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_pprev = &t->tm_next;
+	}
+	*head = t;
+	t->tm_pprev = head;
+}
+
+static
+void
+tw_unlink(struct timer *t)
+{
+	*t->tm_pprev = t->tm_next;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_pprev = t->tm_pprev;
+	}
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+}
+
+/*
+ * Put a timer in the right slot for its expiry time. Timers that are
+ * already due go in the current slot.
+ */
+static
+void
+tw_insert(struct timerwheel *tw, struct timer *t)
+{
+	uint64_t slot;
+
+	slot = t->tm_expires >> TW_SHIFT;
+	if (slot < tw->tw_clock) {
+		slot = tw->tw_clock;
+	}
+
+	if (slot - tw->tw_clock < TW_L0_SIZE) {
+		tw_link(&tw->tw_l0[slot & TW_L0_MASK], t);
+	}
+	else if ((slot >> TW_L0_BITS) - (tw->tw_clock >> TW_L0_BITS)
+		 < TW_L1_SIZE) {
+		tw_link(&tw->tw_l1[(slot >> TW_L0_BITS) & TW_L1_MASK], t);
+	}
+	else {
+		tw_link(&tw->tw_far, t);
+	}
+}
+
+/*
+ * Move the timers of a list back through tw_insert, which puts them
+ * one level down if their time has come close enough. The list is
+ * detached first, since timers that are still far away go back into
+ * the same list.
+ */
+static
+void
+tw_cascade(struct timerwheel *tw, struct timer **head)
+{
+	struct timer *list, *t;
+
+	list = *head;
+	*head = NULL;
+	if (list != NULL) {
+		list->tm_pprev = &list;
+	}
+
+	while ((t = list) != NULL) {
+		tw_unlink(t);
+		tw_insert(tw, t);
+	}
+}
+
+void
+timer_init(struct timer *t, void (*func)(void *), void *data)
+{
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+	t->tm_wheel = NULL;
+	t->tm_expires = 0;
+	t->tm_func = func;
+	t->tm_data = data;
+}
+
+void
+timer_add(struct timer *t, uint64_t expires)
+{
+	struct timerwheel *tw;
+	int spl;
+
+	KASSERT(t->tm_pprev == NULL);
+
+	/* stay on this cpu until we're done */
+	spl = splhigh();
+
+	tw = curcpu->c_timers;
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		/* the wheel may not have turned for a long time */
+		tw->tw_clock = timer_now() >> TW_SHIFT;
+	}
+	t->tm_wheel = tw;
+	t->tm_expires = expires;
+	tw_insert(tw, t);
+	tw->tw_count++;
+	spinlock_release(&tw->tw_lock);
+
+	/* make sure the timer interrupt comes in time for it */
+	if (expires < curcpu->c_nextevent) {
+		clock_program();
+	}
+
+	splx(spl);
+}
+
+bool
+timer_cancel(struct timer *t)
+{
+	struct timerwheel *tw = t->tm_wheel;
+	bool pending;
+
+	if (tw == NULL) {
+		/* never added */
+		return false;
+	}
+
+	spinlock_acquire(&tw->tw_lock);
+	pending = t->tm_pprev != NULL;
+	if (pending) {
+		tw_unlink(t);
+		KASSERT(tw->tw_count > 0);
+		tw->tw_count--;
+	}
+	spinlock_release(&tw->tw_lock);
+
+	return pending;
+}
+
+/*
+ * Turn the wheel of the current cpu up to NOW, and call the functions
+ * of the timers that expired. Called from the timer interrupt.
+ */
+void
+timerwheel_run(uint64_t now)
+{
+	struct timerwheel *tw = curcpu->c_timers;
+	struct timer *expired, *t, *next;
+	uint64_t nowslot;
+	unsigned idx;
+
+	nowslot = now >> TW_SHIFT;
+	expired = NULL;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		tw->tw_clock = nowslot;
+	}
+	while (tw->tw_count > 0) {
+		idx = tw->tw_clock & TW_L0_MASK;
+		if (idx == 0) {
+			/* starting a new turn of level 0 */
+			tw_cascade(tw, &tw->tw_l1[(tw->tw_clock >> TW_L0_BITS)
+						  & TW_L1_MASK]);
+			tw_cascade(tw, &tw->tw_far);
+		}
+
+		for (t = tw->tw_l0[idx]; t != NULL; t = next) {
+			next = t->tm_next;
+			if (t->tm_expires <= now) {
+				tw_unlink(t);
+				tw->tw_count--;
+				/* tm_pprev stays NULL: no longer pending */
+				t->tm_next = expired;
+				expired = t;
+			}
+		}
+
+		if (tw->tw_clock >= nowslot) {
+			break;
+		}
+		tw->tw_clock++;
+	}
+	if (tw->tw_clock < nowslot) {
+		/* ran out of timers on the way */
+		tw->tw_clock = nowslot;
+	}
+	spinlock_release(&tw->tw_lock);
+
+	/* call the functions without the wheel locked */
+	for (t = expired; t != NULL; t = next) {
+		next = t->tm_next;
+		t->tm_next = NULL;
+		t->tm_func(t->tm_data);
+	}
+}
+
+/*
+ * Return when the next timer of the current cpu expires. For timers
+ * beyond level 0 this returns the time they get moved down, which is
+ * earlier; the clock code then asks again.
+ */
+uint64_t
+timerwheel_next(void)
+{
+	struct timerwheel *tw = curcpu->c_timers;
+	struct timer *t;
+	uint64_t next, turn;
+	unsigned i;
+
+	next = TIMER_NEVER;
+
+	spinlock_acquire(&tw->tw_lock);
+	if (tw->tw_count == 0) {
+		goto done;
+	}
+
+	for (i=0; i<TW_L0_SIZE; i++) {
+		for (t = tw->tw_l0[(tw->tw_clock + i) & TW_L0_MASK]; t != NULL;
+		     t = t->tm_next) {
+			if (t->tm_expires < next) {
+				next = t->tm_expires;
+			}
+		}
+		if (next != TIMER_NEVER) {
+			goto done;
+		}
+	}
+
+	turn = tw->tw_clock >> TW_L0_BITS;
+	for (i=1; i<TW_L1_SIZE; i++) {
+		if (tw->tw_l1[(turn + i) & TW_L1_MASK] != NULL) {
+			next = ((turn + i) << TW_L0_BITS) << TW_SHIFT;
+			goto done;
+		}
+	}
+
+	for (t = tw->tw_far; t != NULL; t = t->tm_next) {
+		if (t->tm_expires < next) {
+			next = t->tm_expires;
+		}
+	}
+
+ done:
+	spinlock_release(&tw->tw_lock);
+	return next;
+}
@@ -111,6 +111,7 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create vfs big lock\n");
 	}
 	vfs_biglock_depth = 0;
+	LOCKPROF_LOCK(vfs_biglock, "vfs_biglock");
 
 	devnull_create();
 	semfs_bootstrap();
@@ -131,20 +132,10 @@ vfs_biglock_acquire(void)
 	}
 	else if (vfs_biglock_depth == 0) {
 		/*
-		 * Supposedly we hold it, but the depth is 0. This may
-		 * mean: (1) the count is messed up, or (2)
-		 * lock_do_i_hold is lying. Since OS/161 ships out of
-		 * the box with unimplemented locks (students
-		 * implement them) that always return true, assume
-		 * situation (2). In this case acquire the lock
-		 * anyway.
-		 *
-		 * Once you have working locks, this won't be the
-		 * case, and if you get here it should be situation
-		 * (1), in which case the count is messed up and one
-		 * can panic.
+		 * We hold the lock but the depth is 0: the count is
+		 * messed up.
 		 */
-		lock_acquire(vfs_biglock);
+		panic("vfs_biglock: held with depth 0\n");
 	}
 	vfs_biglock_depth++;
 }
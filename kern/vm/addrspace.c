@@ -36,6 +36,11 @@
 #include <segment.h>
 #include <vm_tlb.h>
 #include <pt.h>
+#include <synch.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <kmem_cache.h>
 #include "opt-stats.h"
 #if OPT_STATS
 #include <vmstats.h>
@@ -45,12 +50,44 @@
 #define VM_STACKPAGES    18
 
 #if OPT_RUDEVM
+/**
+ * @brief address spaces are kept in a cache with their fault
+ * semaphore already created, so that as_create does not have to
+ * make one every time.
+ */
+static
+int
+as_ctor(void *obj)
+{
+	struct addrspace *as = obj;
+
+	as->as_faultsem = sem_create("as_fault", 1);
+	if (as->as_faultsem == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+as_dtor(void *obj)
+{
+	struct addrspace *as = obj;
+
+	sem_destroy(as->as_faultsem);
+}
+
+static struct kmem_cache as_cache =
+	KMEM_CACHE_INITIALIZER("addrspace", sizeof(struct addrspace),
+			       as_ctor, as_dtor);
+
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as;
+	unsigned i;
 
-	as = kmalloc(sizeof(struct addrspace));
+	as = kmem_cache_alloc(&as_cache);
 	if (as == NULL) {
 		return NULL;
 	}
@@ -59,6 +96,9 @@ as_create(void)
 	as->as_text = NULL;
 	as->as_stack = NULL;
 	as->as_ptable = NULL;
+	for (i = 0; i < AS_NFAULTS; i++) {
+		as->as_faults[i] = 0;
+	}
 
 	return as;
 }
@@ -92,18 +132,22 @@ as_destroy(struct addrspace *as)
 	segment_destroy(as->as_data);
 	segment_destroy(as->as_stack);
 
-	kfree(as);
+	/* the fault semaphore stays with the cached address space */
+	KASSERT(as->as_faultsem->sem_count == 1);
+	kmem_cache_free(&as_cache, as);
 }
 
 /**
  * @brief 	if the process is a USER process, the tlb
- * 			is totally invalidated.
+ * 			is totally invalidated. The cpu is recorded as
+ * 			a target for the shootdowns of this address space.
  * 
  */
 void
 as_activate(void)
 {
 	struct addrspace *as;
+	int spl;
 
 	as = proc_getas();
 	if (as == NULL) {
@@ -114,7 +158,13 @@ as_activate(void)
 		return;
 	}
 
+	spl = splhigh();
+	spinlock_acquire(&curcpu->c_ipi_lock);
+	curcpu->c_tlb_as = as;
+	spinlock_release(&curcpu->c_ipi_lock);
+
 	tlb_invalidate();
+	splx(spl);
 }
 
 void
@@ -177,6 +227,10 @@ as_define_region(struct addrspace *as, vaddr_t first_vaddr, size_t memsize, off_
 
 /**
  * @brief set up a segment for the stack.
+ * The segment holds one stack of VM_STACKPAGES pages for each of
+ * the UTHREAD_MAX threads a process can have; the main thread uses
+ * the topmost one. Pages are loaded on demand, so unused stacks only
+ * cost their page table entries.
  * 
  * @param as 
  * @param stackptr 
@@ -185,17 +239,36 @@ as_define_region(struct addrspace *as, vaddr_t first_vaddr, size_t memsize, off_
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+	size_t npages = VM_STACKPAGES * UTHREAD_MAX;
+
 	KASSERT(as != NULL);
 
 	as->as_stack = segment_create();
-	segment_define(as->as_stack, 0, USERSTACK - VM_STACKPAGES * PAGE_SIZE, USERSTACK - VM_STACKPAGES * PAGE_SIZE, USERSTACK, VM_STACKPAGES, 0);
+	segment_define(as->as_stack, 0, USERSTACK - npages * PAGE_SIZE, USERSTACK - npages * PAGE_SIZE, USERSTACK, npages, 0);
 	
 	/* Initial user-level stack pointer */
-	*stackptr = USERSTACK;
+	*stackptr = as_get_stacktop(as, 0);
 
 	return 0;
 }
 
+/**
+ * @brief get the initial stack pointer of the user thread in the
+ * given slot.
+ * 
+ * @param as 
+ * @param slot 
+ * @return vaddr_t 
+ */
+vaddr_t
+as_get_stacktop(struct addrspace *as, unsigned slot)
+{
+	KASSERT(as != NULL);
+	KASSERT(slot < UTHREAD_MAX);
+
+	return USERSTACK - slot * VM_STACKPAGES * PAGE_SIZE;
+}
+
 /**
  * @brief setup the page table for the address space
  * 
@@ -214,6 +214,79 @@ copyout(const void *src, userptr_t userdest, size_t len)
 	return 0;
 }
 
+/*
+ * Common function for copyinv and copyoutv.
+ *
+ * All the regions are checked before touching any of them, then a
+ * single tm_badfaultfunc/setjmp section covers all the copies, rather
+ * than paying the setup once per region.
+ */
+static
+int
+copyv(const struct copyvec *vec, unsigned nvec, bool in)
+{
+	int result;
+	size_t stoplen;
+	unsigned i;
+
+	for (i=0; i<nvec; i++) {
+		result = copycheck(vec[i].cv_ubase, vec[i].cv_len, &stoplen);
+		if (result) {
+			return result;
+		}
+		if (stoplen != vec[i].cv_len) {
+			/* Single block, can't legally truncate it. */
+			return EFAULT;
+		}
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	for (i=0; i<nvec; i++) {
+		if (in) {
+			memcpy(vec[i].cv_kbase, (const void *)vec[i].cv_ubase,
+			       vec[i].cv_len);
+		}
+		else {
+			memcpy((void *)vec[i].cv_ubase, vec[i].cv_kbase,
+			       vec[i].cv_len);
+		}
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * copyinv
+ *
+ * Copy NVEC blocks of memory from user-level addresses to kernel
+ * addresses, as described by VEC.
+ */
+int
+copyinv(const struct copyvec *vec, unsigned nvec)
+{
+	return copyv(vec, nvec, true);
+}
+
+/*
+ * copyoutv
+ *
+ * Copy NVEC blocks of memory from kernel addresses to user-level
+ * addresses, as described by VEC.
+ */
+int
+copyoutv(const struct copyvec *vec, unsigned nvec)
+{
+	return copyv(vec, nvec, false);
+}
+
 /*
  * Common string copying function that behaves the way that's desired
  * for copyinstr and copyoutstr.
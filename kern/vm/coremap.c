@@ -7,16 +7,28 @@
 #include <pt.h>
 #include <vm_tlb.h>
 #include <synch.h>
+#include <cpu.h>
+#include <vmtrace.h>
 #include "opt-swap.h"
 #include "opt-noswap_rdonly.h"
+#include "opt-stats.h"
+
+#if OPT_STATS
+#include <timer.h>
+#include <vmstats.h>
+#endif
+
+/* Max number of frames evicted at once when memory runs out. */
+#define COREMAP_RECLAIM_BATCH 4
 
 vaddr_t firstfree; /* first free virtual address; set by start.S */
 
-struct spinlock cm_spinlock = SPINLOCK_INITIALIZER;
+/* taken by every fault and allocation on every cpu: hand it out in order */
+struct spinlock cm_spinlock = SPINLOCK_TICKET_INITIALIZER;
 
 static int        coremap_find_freeframes(int npages);
 #if OPT_SWAP
-static int        coremap_get_victim();
+static int        coremap_get_victim(void);
 static int        coremap_swapout(int npages);
 static int        victim_index = 0;
 #endif
@@ -81,7 +93,11 @@ void coremap_bootstrap(){
     coremap[i].cm_allocsize = 0;
     coremap[i].cm_used = 0;
     coremap[i].cm_lock = 0;
+    coremap[i].cm_evicting = 0;
+    coremap[i].cm_orphan = 0;
+    coremap[i].cm_pins = 0;
     coremap[i].cm_ptentry = NULL;
+    coremap[i].cm_as = NULL;
   }
 
   /* 
@@ -94,6 +110,8 @@ void coremap_bootstrap(){
     coremap[i].cm_allocsize = 1;
   }
 
+  /* the coremap is up, so kmalloc works from here */
+  LOCKPROF_SPINLOCK(&cm_spinlock, "cm_spinlock");
 }
 
 /**
@@ -143,7 +161,7 @@ coremap_find_freeframes(int npages)
  * @return index of the swappable page, -1 if not found.
  */
 static int
-coremap_get_victim()
+coremap_get_victim(void)
 {
   int i;
 
@@ -152,7 +170,8 @@ coremap_get_victim()
     victim_index = (victim_index + 1) % nRamFrames;
 
     /* Swap out only user pages */
-    if(coremap[victim_index].cm_ptentry != NULL && !coremap[victim_index].cm_lock)
+    if(coremap[victim_index].cm_ptentry != NULL && !coremap[victim_index].cm_lock &&
+       coremap[victim_index].cm_pins == 0)
     {
       KASSERT(coremap[victim_index].cm_used == 1);
       KASSERT(coremap[victim_index].cm_allocsize == 1);
@@ -165,75 +184,192 @@ coremap_get_victim()
 }
 
 /**
- * @brief swap out pages from memory.
+ * @brief evict a batch of up to COREMAP_RECLAIM_BATCH user frames,
+ * return one of them to the caller and free the others.
+ * Called with cm_spinlock held, which is released while waiting for
+ * the TLB shootdowns and writing the pages to the swap file.
+ * 
+ * Evicting several frames at a time lets all of them share a single
+ * round of TLB shootdowns: each CPU that may map one of the frames
+ * gets one IPI for the whole batch.
  * 
  * @param npages
- * @return index of the frame swapped out.
+ * @return index of the frame given to the caller.
  */
 static int
 coremap_swapout(int npages)
 {
-  int victim_index;
-  int swap_index;
+  int victims[COREMAP_RECLAIM_BATCH];
+  struct tlbshootdown ts[COREMAP_RECLAIM_BATCH];
+  unsigned int swap_index[COREMAP_RECLAIM_BATCH];
+  int nvictims;
+  int index;
+  int i;
 
   if(npages > 1)
   {
     panic("Cannot swap out multiple pages");
   }
 
-  victim_index = coremap_get_victim(npages);
-  if(victim_index == -1)
+  for(nvictims = 0; nvictims < COREMAP_RECLAIM_BATCH; nvictims++)
   {
-    panic("Cannot find swappable victim");
-  }
+    index = coremap_get_victim();
+    if(index == -1)
+    {
+      break;
+    }
+
+    /**  
+     * protect the coremap entry while is swapping out,
+     * as the cm_lock = 1 prevent the frame to be selected
+     * as a victim for another concurrent swap out, while
+     * cm_evicting prevents vm_fault from mapping or pinning
+     * it again.
+     */
+    coremap[index].cm_lock = 1;
+    coremap[index].cm_evicting = 1;
+    victims[nvictims] = index;
+    swap_index[nvictims] = 0;
+    ts[nvictims].ts_paddr = index * PAGE_SIZE;
+    ts[nvictims].ts_as = coremap[index].cm_as;
 
 #if OPT_NOSWAP_RDONLY
-  if(coremap[victim_index].cm_ptentry->pt_status == IN_MEMORY_RDONLY){
-    pt_set_entry(coremap[victim_index].cm_ptentry,0,0,NOT_LOADED);
-    tlb_remove_by_paddr(victim_index * PAGE_SIZE);
-    return victim_index;
-  }
+    /* read-only pages are simply reloaded from the elf file */
+    if(coremap[index].cm_ptentry->pt_status == IN_MEMORY_RDONLY)
+    {
+      pt_set_entry(coremap[index].cm_ptentry,0,0,NOT_LOADED);
+      coremap[index].cm_evicting = 0;
+    }
 #endif
+  }
+
+  if(nvictims == 0)
+  {
+    panic("Cannot find swappable victim");
+  }
 
-  /**  
-   * protect the coremap entry while is swapping out,
-   * as the cm_lock = 1 prevent the frame to be selected
-   * as a victim for another concurrent swap out.
-   */
-  coremap[victim_index].cm_lock = 1;
   spinlock_release(&cm_spinlock);
-  swap_index = swap_out(victim_index * PAGE_SIZE);
+
+  /* no CPU can access the frames any more after this */
+  ipi_tlbshootdown_sync(ts, nvictims);
+
+  for(i = 0; i < nvictims; i++)
+  {
+    if(coremap[victims[i]].cm_evicting)
+    {
+      swap_index[i] = swap_out(victims[i] * PAGE_SIZE);
+      VMTRACE(VMT_EVICT, VMT_EVICT_SWAPPED, ts[i].ts_as, ts[i].ts_paddr,
+              swap_index[i]);
+    }
+    else
+    {
+      VMTRACE(VMT_EVICT, VMT_EVICT_DROPPED, ts[i].ts_as, ts[i].ts_paddr, 0);
+    }
+  }
+
   spinlock_acquire(&cm_spinlock);
-  coremap[victim_index].cm_lock = 0;
-  
+  for(i = 0; i < nvictims; i++)
+  {
+    index = victims[i];
+
+    if(coremap[index].cm_orphan)
+    {
+      /* the page table is gone (coremap_release_page): drop the copy */
+      if(coremap[index].cm_evicting)
+      {
+        swap_free(swap_index[i]);
+      }
+      coremap[index].cm_orphan = 0;
+    }
+    else if(coremap[index].cm_evicting)
+    {
+      /* update the page table */
+      pt_set_entry(coremap[index].cm_ptentry,0,swap_index[i],IN_SWAP);
+    }
+    coremap[index].cm_lock = 0;
+    coremap[index].cm_evicting = 0;
 
-  /* update the page table */
-  pt_set_entry(coremap[victim_index].cm_ptentry,0,swap_index,IN_SWAP);
-  tlb_remove_by_paddr(victim_index * PAGE_SIZE);
+    /* the first frame goes to the caller, the others are freed */
+    if(i > 0)
+    {
+      coremap[index].cm_used = 0;
+      coremap[index].cm_allocsize = 0;
+      coremap[index].cm_ptentry = NULL;
+      coremap[index].cm_as = NULL;
+    }
+  }
 
-  return victim_index;
+  return victims[0];
 }
 #endif
 
+/**
+ * @brief reload the TLB mapping of a resident page, unless its frame
+ * is being evicted. The check and the insertion are done atomically
+ * with respect to eviction: an eviction starting right after it will
+ * shoot the new mapping down.
+ * 
+ * @param ptentry 
+ * @param vaddr 
+ * @param readonly 
+ * @param count incremented, under the coremap lock, if the mapping is
+ * inserted: the threads of a process reload in parallel.
+ * @return true if the mapping has been inserted.
+ */
+bool
+coremap_tlb_reload(struct pt_entry *ptentry, vaddr_t vaddr, bool readonly,
+                   unsigned *count)
+{
+  unsigned int index;
+  bool reloaded = false;
+
+  spinlock_acquire(&cm_spinlock);
+  if (ptentry->pt_status == IN_MEMORY || ptentry->pt_status == IN_MEMORY_RDONLY)
+  {
+    index = ptentry->pt_frame_index;
+    if (!coremap[index].cm_evicting)
+    {
+      tlb_insert(vaddr, index * PAGE_SIZE, readonly);
+      (*count)++;
+      reloaded = true;
+    }
+  }
+  spinlock_release(&cm_spinlock);
+
+  return reloaded;
+}
+
 /**
  * @brief get npages from the ram.
  * 
+ * User pages (ptentry != NULL) are returned pinned, see coremap_unpin_frame.
+ * 
  * @param npages
  * @param ptentry
+ * @param as address space of the page, NULL if kernel's page.
  * @return paddr_t of the pages, 0 if no pages are available.
  */
 paddr_t
-coremap_getppages(int npages, struct pt_entry *ptentry)
+coremap_getppages(int npages, struct pt_entry *ptentry, struct addrspace *as)
 {
   int i;
   int beginning;
+#if OPT_STATS && OPT_SWAP
+  uint64_t start;
+#endif
 
   spinlock_acquire(&cm_spinlock);
   beginning = coremap_find_freeframes(npages);
   if (beginning == -1)
   {
 #if OPT_SWAP
+#if OPT_STATS
+    start = timer_now();
+#endif
     beginning = coremap_swapout(npages);
+#if OPT_STATS
+    vmstats_latency(VMLAT_EVICT, timer_now() - start);
+#endif
     if (beginning == -1)
     {
       spinlock_release(&cm_spinlock);
@@ -253,6 +389,9 @@ coremap_getppages(int npages, struct pt_entry *ptentry)
   {
     coremap[beginning + i].cm_used = 1;
     coremap[beginning + i].cm_ptentry = ptentry;
+    coremap[beginning + i].cm_as = as;
+    coremap[beginning + i].cm_lock = 0;
+    coremap[beginning + i].cm_pins = (ptentry != NULL);
   }
   spinlock_release(&cm_spinlock);
   return beginning * PAGE_SIZE;
@@ -282,7 +421,174 @@ void coremap_freeppages(paddr_t addr)
   for (i = 0; i < allocSize; i++)
   {
     KASSERT(coremap[first + i].cm_used == 1);
+    KASSERT(coremap[first + i].cm_lock == 0);
     coremap[first + i].cm_used = 0;
+    coremap[first + i].cm_ptentry = NULL;
+    coremap[first + i].cm_as = NULL;
   }
   spinlock_release(&cm_spinlock);
 }
+
+/**
+ * @brief release the frame or the swap slot of a page whose address
+ * space is being destroyed, and mark the page NOT_LOADED.
+ * 
+ * The status of the page is read under cm_spinlock, as an eviction may
+ * be changing it. If the frame is in an eviction batch, which works
+ * without the lock while writing the page out, it is only marked as
+ * orphan: the evictor then frees the swap slot it wrote instead of
+ * updating the page table, and releases the frame itself.
+ * 
+ * @param ptentry 
+ */
+void
+coremap_release_page(struct pt_entry *ptentry)
+{
+  unsigned int index;
+#if OPT_SWAP
+  bool inswap = false;
+  unsigned int swap_index = 0;
+#endif
+
+  spinlock_acquire(&cm_spinlock);
+  switch (ptentry->pt_status)
+  {
+    case IN_MEMORY_RDONLY:
+    case IN_MEMORY:
+      index = ptentry->pt_frame_index;
+      KASSERT((int)index < nRamFrames);
+      KASSERT(coremap[index].cm_ptentry == ptentry);
+
+      if (coremap[index].cm_lock)
+      {
+        coremap[index].cm_orphan = 1;
+      }
+      else
+      {
+        KASSERT(coremap[index].cm_allocsize == 1);
+        coremap[index].cm_used = 0;
+        coremap[index].cm_allocsize = 0;
+        coremap[index].cm_pins = 0;
+        coremap[index].cm_ptentry = NULL;
+        coremap[index].cm_as = NULL;
+      }
+      break;
+    case IN_SWAP:
+#if OPT_SWAP
+      inswap = true;
+      swap_index = ptentry->pt_swap_index;
+#else
+      panic("SWAP Pages should not exists!");
+#endif
+      break;
+    default:
+      break;
+  }
+  pt_set_entry(ptentry, 0, 0, NOT_LOADED);
+  spinlock_release(&cm_spinlock);
+
+#if OPT_SWAP
+  if (inswap)
+  {
+    swap_free(swap_index);
+  }
+#endif
+}
+
+/**
+ * @brief pin the frame holding the page described by ptentry, so that it
+ * cannot be chosen as a swap victim until coremap_unpin_frame is called.
+ * Pins nest: a frame can be pinned several times, e.g. by two buffers of
+ * the same readv that fall in one page, and stays pinned until each pin
+ * is released. Fails if the page is not resident or is being swapped out.
+ * 
+ * @param ptentry 
+ * @return true if the frame has been pinned.
+ */
+bool
+coremap_pin_frame(struct pt_entry *ptentry)
+{
+  unsigned int index;
+  bool pinned = false;
+
+  spinlock_acquire(&cm_spinlock);
+  if (ptentry->pt_status == IN_MEMORY || ptentry->pt_status == IN_MEMORY_RDONLY)
+  {
+    index = ptentry->pt_frame_index;
+    KASSERT((int)index < nRamFrames);
+
+    if (!coremap[index].cm_lock && coremap[index].cm_ptentry == ptentry)
+    {
+      KASSERT(coremap[index].cm_pins < COREMAP_MAXPINS);
+      coremap[index].cm_pins++;
+      pinned = true;
+    }
+  }
+  spinlock_release(&cm_spinlock);
+
+  return pinned;
+}
+
+/**
+ * @brief release a pin taken by coremap_pin_frame or coremap_getppages.
+ * 
+ * @param addr physical address of the frame.
+ */
+void
+coremap_unpin_frame(paddr_t addr)
+{
+  long index;
+
+  KASSERT(addr % PAGE_SIZE == 0);
+
+  index = addr / PAGE_SIZE;
+  KASSERT(nRamFrames > index);
+
+  spinlock_acquire(&cm_spinlock);
+  KASSERT(coremap[index].cm_pins > 0);
+  coremap[index].cm_pins--;
+  spinlock_release(&cm_spinlock);
+}
+
+/**
+ * @brief take a snapshot of the state of the frames: one of the
+ * COREMAP_ characters per frame, for at most len frames.
+ * 
+ * @param map 
+ * @param len 
+ * @return unsigned the number of frames in the map.
+ */
+unsigned
+coremap_occupancy(char *map, unsigned len)
+{
+  unsigned i;
+
+  if (len > (unsigned)nRamFrames)
+  {
+    len = nRamFrames;
+  }
+
+  spinlock_acquire(&cm_spinlock);
+  for (i = 0; i < len; i++)
+  {
+    if (!coremap[i].cm_used)
+    {
+      map[i] = COREMAP_FREE;
+    }
+    else if (coremap[i].cm_ptentry == NULL)
+    {
+      map[i] = COREMAP_KERNEL;
+    }
+    else if (coremap[i].cm_lock || coremap[i].cm_evicting || coremap[i].cm_pins > 0)
+    {
+      map[i] = COREMAP_LOCKED;
+    }
+    else
+    {
+      map[i] = COREMAP_USER;
+    }
+  }
+  spinlock_release(&cm_spinlock);
+
+  return len;
+}
@@ -0,0 +1,339 @@
+/*
+ * Kernel heap profiler. See kheapprof.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <timer.h>
+#include <vm.h>
+#include <kheapprof.h>
+
+/*
+ * Call sites, in an open-addressing hash table. When it fills up,
+ * further call sites are counted together in an extra slot past the
+ * end of the table, KHP_OTHER, reported as "(other)".
+ */
+#define KHP_NSITES 512
+#define KHP_OTHER KHP_NSITES
+#define KHP_NSLOTS (KHP_NSITES + 1)
+
+struct khp_site {
+	vaddr_t ks_site;		/* 0 if the slot is free */
+	size_t ks_livebytes;
+	unsigned ks_liveblocks;
+	unsigned ks_allocs;		/* since the last reset */
+	unsigned ks_lastallocs;		/* ks_allocs at the last report */
+};
+
+/*
+ * Live blocks, also in an open-addressing hash table, taken from the
+ * page allocator when the profiler is turned on (so that the profiler
+ * doesn't profile itself).
+ */
+#define KHP_TABLEPAGES 16
+#define KHP_NBLOCKS (KHP_TABLEPAGES * PAGE_SIZE / sizeof(struct khp_block))
+
+struct khp_block {
+	vaddr_t kb_ptr;			/* 0 if the slot is free */
+	size_t kb_size;
+	unsigned kb_site;		/* index into khp_sites */
+};
+
+volatile bool kheapprof_on;
+
+static struct spinlock khp_lock = SPINLOCK_INITIALIZER;
+static struct khp_site khp_sites[KHP_NSLOTS];
+static unsigned khp_nsites;
+static struct khp_block *khp_blocks;
+static unsigned khp_nblocks;
+static unsigned khp_untracked;		/* allocations the table had no room for */
+static uint64_t khp_lastreport;		/* time of the last report */
+
+static
+unsigned
+khp_hash(vaddr_t addr)
+{
+	/* the low bits of pointers and return addresses are all alike */
+	return (addr >> 2) * 2654435761U;
+}
+
+/*
+ * Find (or add) the slot of a call site.
+ */
+static
+unsigned
+khp_getsite(vaddr_t site)
+{
+	unsigned i, n;
+
+	i = khp_hash(site) % KHP_NSITES;
+	for (n = 0; n < KHP_NSITES; n++) {
+		if (khp_sites[i].ks_site == site) {
+			return i;
+		}
+		if (khp_sites[i].ks_site == 0) {
+			if (khp_nsites >= KHP_NSITES - 1) {
+				/* keep a free slot so lookups end */
+				break;
+			}
+			khp_sites[i].ks_site = site;
+			khp_nsites++;
+			return i;
+		}
+		i = (i + 1) % KHP_NSITES;
+	}
+	return KHP_OTHER;
+}
+
+void
+kheapprof_alloc(void *ptr, size_t size, vaddr_t site)
+{
+	struct khp_site *ks;
+	unsigned i, n;
+
+	spinlock_acquire(&khp_lock);
+	if (khp_blocks == NULL) {
+		/* just turned off */
+		spinlock_release(&khp_lock);
+		return;
+	}
+
+	ks = &khp_sites[khp_getsite(site)];
+	ks->ks_allocs++;
+
+	/* keep a free slot, so lookups end */
+	if (khp_nblocks >= KHP_NBLOCKS - 1) {
+		khp_untracked++;
+		spinlock_release(&khp_lock);
+		return;
+	}
+
+	i = khp_hash((vaddr_t)ptr) % KHP_NBLOCKS;
+	for (n = 0; khp_blocks[i].kb_ptr != 0; n++) {
+		KASSERT(n < KHP_NBLOCKS);
+		i = (i + 1) % KHP_NBLOCKS;
+	}
+	khp_blocks[i].kb_ptr = (vaddr_t)ptr;
+	khp_blocks[i].kb_size = size;
+	khp_blocks[i].kb_site = ks - khp_sites;
+	khp_nblocks++;
+
+	ks->ks_livebytes += size;
+	ks->ks_liveblocks++;
+
+	spinlock_release(&khp_lock);
+}
+
+void
+kheapprof_free(void *ptr)
+{
+	struct khp_site *ks;
+	unsigned i, j, home;
+
+	spinlock_acquire(&khp_lock);
+	if (khp_blocks == NULL) {
+		spinlock_release(&khp_lock);
+		return;
+	}
+
+	i = khp_hash((vaddr_t)ptr) % KHP_NBLOCKS;
+	while (khp_blocks[i].kb_ptr != (vaddr_t)ptr) {
+		if (khp_blocks[i].kb_ptr == 0) {
+			/* allocated while we were off */
+			spinlock_release(&khp_lock);
+			return;
+		}
+		i = (i + 1) % KHP_NBLOCKS;
+	}
+
+	ks = &khp_sites[khp_blocks[i].kb_site];
+	KASSERT(ks->ks_liveblocks > 0);
+	ks->ks_livebytes -= khp_blocks[i].kb_size;
+	ks->ks_liveblocks--;
+	khp_nblocks--;
+
+	/*
+	 * Delete without leaving a hole in the probe sequence of the
+	 * blocks after it: move back each one that would no longer be
+	 * found.
+	 */
+	j = i;
+	while (1) {
+		khp_blocks[i].kb_ptr = 0;
+		do {
+			j = (j + 1) % KHP_NBLOCKS;
+			if (khp_blocks[j].kb_ptr == 0) {
+				spinlock_release(&khp_lock);
+				return;
+			}
+			home = khp_hash(khp_blocks[j].kb_ptr) % KHP_NBLOCKS;
+			/* can it stay, i.e. is home cyclically in (i, j]? */
+		} while (i <= j ? (i < home && home <= j)
+			 : (i < home || home <= j));
+		khp_blocks[i] = khp_blocks[j];
+		i = j;
+	}
+}
+
+int
+kheapprof_start(void)
+{
+	vaddr_t table;
+	unsigned i;
+
+	if (kheapprof_on) {
+		return 0;
+	}
+
+	table = alloc_kpages(KHP_TABLEPAGES);
+	if (table == 0) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&khp_lock);
+	khp_blocks = (struct khp_block *)table;
+	for (i = 0; i < KHP_NBLOCKS; i++) {
+		khp_blocks[i].kb_ptr = 0;
+	}
+	khp_nblocks = 0;
+	/* blocks from before aren't live as far as we know */
+	for (i = 0; i < KHP_NSLOTS; i++) {
+		khp_sites[i].ks_livebytes = 0;
+		khp_sites[i].ks_liveblocks = 0;
+	}
+	khp_lastreport = timer_now();
+	kheapprof_on = true;
+	spinlock_release(&khp_lock);
+
+	return 0;
+}
+
+void
+kheapprof_stop(void)
+{
+	struct khp_block *table;
+
+	spinlock_acquire(&khp_lock);
+	kheapprof_on = false;
+	table = khp_blocks;
+	khp_blocks = NULL;
+	spinlock_release(&khp_lock);
+
+	if (table != NULL) {
+		free_kpages((vaddr_t)table);
+	}
+}
+
+void
+kheapprof_reset(void)
+{
+	unsigned i;
+
+	spinlock_acquire(&khp_lock);
+	for (i = 0; i < KHP_NSLOTS; i++) {
+		khp_sites[i].ks_site = 0;
+		khp_sites[i].ks_livebytes = 0;
+		khp_sites[i].ks_liveblocks = 0;
+		khp_sites[i].ks_allocs = 0;
+		khp_sites[i].ks_lastallocs = 0;
+	}
+	khp_nsites = 0;
+	if (khp_blocks != NULL) {
+		for (i = 0; i < KHP_NBLOCKS; i++) {
+			khp_blocks[i].kb_ptr = 0;
+		}
+	}
+	khp_nblocks = 0;
+	khp_untracked = 0;
+	khp_lastreport = timer_now();
+	spinlock_release(&khp_lock);
+}
+
+/*
+ * Print the line of the site in slot I. ELAPSED is the time since the
+ * last report, in ns.
+ */
+static
+void
+khp_printsite(unsigned i, uint64_t elapsed)
+{
+	struct khp_site *ks = &khp_sites[i];
+	unsigned rate;
+
+	rate = elapsed == 0 ? 0 :
+		(ks->ks_allocs - ks->ks_lastallocs) * 1000000000ULL / elapsed;
+	if (i == KHP_OTHER) {
+		kprintf("%-10s ", "(other)");
+	}
+	else {
+		kprintf("0x%08x ", ks->ks_site);
+	}
+	kprintf("%10lu %8u %10u %9u\n", (unsigned long)ks->ks_livebytes,
+		ks->ks_liveblocks, ks->ks_allocs, rate);
+}
+
+/*
+ * Print the top N call sites by live bytes, and the sites that did
+ * not fit in the table if they are not among them. Selection sort on
+ * a copy of the site indexes, as N is small and there aren't many
+ * sites.
+ */
+void
+kheapprof_print(unsigned n)
+{
+	static unsigned order[KHP_NSLOTS];
+	unsigned nsites, i, j, best, tmp;
+	uint64_t now, elapsed;
+	bool othershown;
+
+	spinlock_acquire(&khp_lock);
+
+	now = timer_now();
+	elapsed = now - khp_lastreport;
+	khp_lastreport = now;
+
+	nsites = 0;
+	for (i = 0; i < KHP_NSLOTS; i++) {
+		if (khp_sites[i].ks_site != 0 || khp_sites[i].ks_allocs > 0) {
+			order[nsites++] = i;
+		}
+	}
+	if (n > nsites) {
+		n = nsites;
+	}
+
+	kprintf("Kernel heap profile (%s), %u call sites, %u blocks "
+		"tracked, %u untracked\n", kheapprof_on ? "on" : "off",
+		nsites, khp_nblocks, khp_untracked);
+	kprintf("%-10s %10s %8s %10s %9s\n", "call site", "live bytes",
+		"blocks", "allocs", "allocs/s");
+	othershown = false;
+	for (i = 0; i < n; i++) {
+		best = i;
+		for (j = i + 1; j < nsites; j++) {
+			if (khp_sites[order[j]].ks_livebytes >
+			    khp_sites[order[best]].ks_livebytes) {
+				best = j;
+			}
+		}
+		tmp = order[i];
+		order[i] = order[best];
+		order[best] = tmp;
+
+		khp_printsite(order[i], elapsed);
+		if (order[i] == KHP_OTHER) {
+			othershown = true;
+		}
+	}
+	if (!othershown && khp_sites[KHP_OTHER].ks_allocs > 0) {
+		khp_printsite(KHP_OTHER, elapsed);
+	}
+
+	for (i = 0; i < KHP_NSLOTS; i++) {
+		khp_sites[i].ks_lastallocs = khp_sites[i].ks_allocs;
+	}
+
+	spinlock_release(&khp_lock);
+}
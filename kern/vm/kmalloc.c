@@ -29,8 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
+#include <cpu.h>
 #include <spinlock.h>
+#include <current.h>
 #include <vm.h>
+#include <kmem_cache.h>
+#include <kheapprof.h>
 
 /*
  * Kernel malloc.
@@ -160,10 +165,9 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the pages and their free lists. Most
+ * allocations and frees don't get this far, as each cpu keeps a
+ * magazine of free blocks of each size (see below).
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -345,6 +349,122 @@ freepageref(struct pageref *p)
 static struct pageref *sizebases[NSIZES];
 static struct pageref *allbase;
 
+/*
+ * Reverse map from heap page to its pageref, so kfree can find the
+ * page of a block without searching allbase. As with the pageref
+ * pages, assume System/161's 16M of RAM. An entry is set when a page
+ * becomes a subpage heap page and cleared before the page is freed;
+ * in between it does not change, so it can be read without the lock
+ * by whoever holds a block on the page.
+ */
+#define KHEAP_MAXPAGES (16*1024*1024 / PAGE_SIZE)
+
+static struct pageref *pagerefmap[KHEAP_MAXPAGES];
+
+static
+struct pageref *
+findpageref(vaddr_t ptraddr)
+{
+	paddr_t pa;
+
+	/* pointers outside kseg0 come out huge */
+	pa = KVADDR_TO_PADDR(ptraddr);
+	if (pa / PAGE_SIZE >= KHEAP_MAXPAGES) {
+		return NULL;
+	}
+	return pagerefmap[pa / PAGE_SIZE];
+}
+
+static
+void
+setpageref(vaddr_t prpage, struct pageref *pr)
+{
+	paddr_t pa;
+
+	pa = KVADDR_TO_PADDR(prpage);
+	KASSERT(pa / PAGE_SIZE < KHEAP_MAXPAGES);
+	pagerefmap[pa / PAGE_SIZE] = pr;
+}
+
+/*
+ * Per-cpu magazines.
+ *
+ * Each cpu keeps, for each block size, a small stack of free blocks
+ * that it allocates from and frees to with interrupts off but without
+ * taking kmalloc_spinlock. When it runs dry it takes half a magazine's
+ * worth of blocks from the pages at once, and when it overflows it
+ * gives half of them back. A magazine holds at most a page worth of
+ * blocks, and no more than KMAG_MAXBLOCKS.
+ *
+ * Blocks in a magazine are allocated as far as their page is
+ * concerned, so the heap dumps of LABELS and the allocated block
+ * checks of CHECKGUARDS would trip over them; with either of those
+ * the magazines are not used.
+ */
+
+#if defined(LABELS) || defined(CHECKGUARDS)
+#define KMAG_ENABLED 0
+#else
+#define KMAG_ENABLED 1
+#endif
+
+#define KMAG_MAXCPUS 32
+#define KMAG_MAXBLOCKS 16
+
+struct kmag {
+	struct freelist *km_blocks;
+	unsigned km_count;
+};
+
+static struct kmag kmags[KMAG_MAXCPUS][NSIZES];
+
+static
+unsigned
+kmag_capacity(unsigned blktype)
+{
+	unsigned n;
+
+	n = PAGE_SIZE / sizes[blktype];
+	return n < KMAG_MAXBLOCKS ? n : KMAG_MAXBLOCKS;
+}
+
+/*
+ * Get the current cpu's magazine for blocks of type BLKTYPE, or NULL
+ * if there isn't one. Must be called with interrupts off, and the
+ * magazine must be let go of before they go back on.
+ */
+static
+struct kmag *
+kmag_mine(unsigned blktype)
+{
+	if (!KMAG_ENABLED || !CURCPU_EXISTS() ||
+	    curcpu->c_number >= KMAG_MAXCPUS) {
+		return NULL;
+	}
+	return &kmags[curcpu->c_number][blktype];
+}
+
+/*
+ * Take blocks off a magazine until it has KEEP left, and return them
+ * as a list.
+ */
+static
+struct freelist *
+kmag_take(struct kmag *mag, unsigned keep)
+{
+	struct freelist *blocks, *fl;
+
+	blocks = NULL;
+	while (mag->km_count > keep) {
+		fl = mag->km_blocks;
+		mag->km_blocks = fl->next;
+		mag->km_count--;
+		fl->next = blocks;
+		blocks = fl;
+	}
+	return blocks;
+}
+
 ////////////////////////////////////////
 
 #ifdef GUARDS
@@ -801,6 +921,7 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i, j;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -811,7 +932,29 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	/*
+	 * The blocks in the magazines show up as allocated above.
+	 * Other cpus change theirs as we go, so this is approximate.
+	 */
+	if (KMAG_ENABLED) {
+		kprintf("Per-cpu magazines (free blocks of each size):\n");
+		kprintf("      ");
+		for (j=0; j<NSIZES; j++) {
+			kprintf(" %5lu", (unsigned long) sizes[j]);
+		}
+		kprintf("\n");
+		for (i=0; i<KMAG_MAXCPUS && i<cpu_count(); i++) {
+			kprintf("cpu%-2u:", i);
+			for (j=0; j<NSIZES; j++) {
+				kprintf(" %5u", kmags[i][j].km_count);
+			}
+			kprintf("\n");
+		}
+	}
+
 	spinlock_release(&kmalloc_spinlock);
+
+	kmem_cache_printstats();
 }
 
 ////////////////////////////////////////
@@ -867,67 +1010,46 @@ int blocktype(size_t clientsz)
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take up to N free blocks of type BLKTYPE from the heap pages,
+ * making a fresh page if there are none. Returns them as a list, or
+ * NULL if out of memory.
  */
 static
-void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+struct freelist *
+subpage_getblocks(unsigned blktype, unsigned n)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
-	void *retptr;		// our result
+	struct freelist *block;	// block we're taking
+	struct freelist *blocks;	// our result
+	unsigned got;
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-#ifdef GUARDS
-	sz = sizes[blktype];
-#endif
+	blocks = NULL;
+	got = 0;
 
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+ again:
+	for (pr = sizebases[blktype]; pr != NULL && got < n;
+	     pr = pr->next_samesize) {
 
 		/* check for corruption */
 		KASSERT(PR_BLOCKTYPE(pr) == blktype);
 		checksubpage(pr);
 
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
+		while (pr->nfree > 0 && got < n) {
 			KASSERT(pr->freelist_offset < PAGE_SIZE);
 			prpage = PR_PAGEADDR(pr);
 			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+			block = (struct freelist *)fla;
 
-			retptr = fl;
-			fl = fl->next;
+			fl = block->next;
 			pr->nfree--;
 
 			if (fl != NULL) {
@@ -940,20 +1062,19 @@ subpage_kmalloc(size_t sz
 				KASSERT(pr->nfree == 0);
 				pr->freelist_offset = INVALID_OFFSET;
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
-
-			checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
+			block->next = blocks;
+			blocks = block;
+			got++;
 		}
 	}
 
+	if (got > 0) {
+		checksubpages();
+		spinlock_release(&kmalloc_spinlock);
+		return blocks;
+	}
+
 	/*
 	 * No page of the right size available.
 	 * Make a new one.
@@ -1013,8 +1134,178 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	setpageref(prpage, pr);
+
+	/* Now there are free blocks; go take them. */
+	goto again;
+}
+
+/*
+ * Put a list of free blocks back on their heap pages, freeing the
+ * pages that become entirely free. The blocks should already be
+ * deadbeefed (except for the list link); there may be no more than
+ * KMAG_MAXBLOCKS of them.
+ */
+static
+void
+subpage_putblocks(struct freelist *blocks)
+{
+	int blktype;		// index into sizes[] of the block
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t offset;		// offset into page
+	struct freelist *fl;	// block we're putting back
+	struct freelist *next;	// next block on the list
+	vaddr_t freepages[KMAG_MAXBLOCKS];
+	unsigned nfreepages, i;
+
+	nfreepages = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+
+	checksubpages();
+
+	for (fl = blocks; fl != NULL; fl = next) {
+		next = fl->next;
+
+		pr = findpageref((vaddr_t)fl);
+		KASSERT(pr != NULL);
+		checksubpage(pr);
+		prpage = PR_PAGEADDR(pr);
+		blktype = PR_BLOCKTYPE(pr);
+		offset = (vaddr_t)fl - prpage;
+
+		if (pr->freelist_offset == INVALID_OFFSET) {
+			fl->next = NULL;
+		} else {
+			fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+			/* this block should not already be on the free list! */
+#ifdef SLOW
+			{
+				struct freelist *fl2;
+
+				for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+					KASSERT(fl2 != fl);
+				}
+			}
+#else
+			/* check just the head */
+			KASSERT(fl != fl->next);
+#endif
+		}
+		pr->freelist_offset = offset;
+		pr->nfree++;
+
+		KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+		if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+			/* Whole page is free. */
+			remove_lists(pr, blktype);
+			setpageref(prpage, NULL);
+			freepageref(pr);
+			KASSERT(nfreepages < KMAG_MAXBLOCKS);
+			freepages[nfreepages++] = prpage;
+		}
+	}
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+}
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	struct kmag *mag;	// our cpu's magazine
+	struct freelist *blocks;	// blocks we got
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+	int spl;
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+	blktype = blocktype(sz);
+#ifdef GUARDS
+	sz = sizes[blktype];
+#endif
+
+	spl = splhigh();
+	mag = kmag_mine(blktype);
+	if (mag != NULL && mag->km_blocks != NULL) {
+		/* The common case: no lock needed. */
+		blocks = mag->km_blocks;
+		mag->km_blocks = blocks->next;
+		mag->km_count--;
+		splx(spl);
+	}
+	else {
+		splx(spl);
+
+		/* Get one block for us and, if we can, half a magazine. */
+		blocks = subpage_getblocks(blktype, mag == NULL ? 1 :
+					   kmag_capacity(blktype) / 2 + 1);
+		if (blocks == NULL) {
+			return NULL;
+		}
+
+		if (blocks->next != NULL) {
+			/* We may be on another cpu by now. */
+			spl = splhigh();
+			mag = kmag_mine(blktype);
+			while (blocks->next != NULL && mag != NULL &&
+			       mag->km_count < kmag_capacity(blktype)) {
+				fl = blocks->next;
+				blocks->next = fl->next;
+				fl->next = mag->km_blocks;
+				mag->km_blocks = fl;
+				mag->km_count++;
+			}
+			splx(spl);
+			if (blocks->next != NULL) {
+				subpage_putblocks(blocks->next);
+			}
+		}
+	}
+
+	retptr = blocks;
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+#endif
+	return retptr;
 }
 
 /*
@@ -1029,9 +1320,12 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
 	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	struct kmag *mag;	// our cpu's magazine
+	struct freelist *blocks;	// blocks to give back to the pages
+	unsigned capacity;
+	int spl;
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
@@ -1061,34 +1355,16 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	/* The page can't go away while we hold one of its blocks. */
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1108,53 +1384,34 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
+	fl = (struct freelist *)ptraddr;
+	blocks = NULL;
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
+	spl = splhigh();
+	mag = kmag_mine(blktype);
+	if (mag == NULL) {
+		splx(spl);
 		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+		subpage_putblocks(fl);
+		return 0;
+	}
 
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
+	/* check for freeing twice in a row, at least */
+	KASSERT(fl != mag->km_blocks);
 
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
-#else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
-
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
+	capacity = kmag_capacity(blktype);
+	if (mag->km_count >= capacity) {
+		/* Full: give half of it back to the pages. */
+		blocks = kmag_take(mag, capacity / 2);
 	}
+	fl->next = mag->km_blocks;
+	mag->km_blocks = fl;
+	mag->km_count++;
+	splx(spl);
 
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
-#endif
+	if (blocks != NULL) {
+		subpage_putblocks(blocks);
+	}
 
 	return 0;
 }
@@ -1170,17 +1427,14 @@ void *
 kmalloc(size_t sz)
 {
 	size_t checksz;
-#ifdef LABELS
+	void *ptr;
 	vaddr_t label;
-#endif
 
-#ifdef LABELS
 #ifdef __GNUC__
 	label = (vaddr_t)__builtin_return_address(0);
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
-#endif /* LABELS */
 
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
@@ -1195,14 +1449,23 @@ kmalloc(size_t sz)
 		}
 		KASSERT(address % PAGE_SIZE == 0);
 
-		return (void *)address;
+		ptr = (void *)address;
 	}
-
+	else {
 #ifdef LABELS
-	return subpage_kmalloc(sz, label);
+		ptr = subpage_kmalloc(sz, label);
 #else
-	return subpage_kmalloc(sz);
+		ptr = subpage_kmalloc(sz);
 #endif
+		if (ptr == NULL) {
+			return NULL;
+		}
+	}
+
+	if (kheapprof_on) {
+		kheapprof_alloc(ptr, sz, label);
+	}
+	return ptr;
 }
 
 /*
@@ -1216,7 +1479,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+	if (kheapprof_on) {
+		kheapprof_free(ptr);
+	}
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
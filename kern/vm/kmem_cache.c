@@ -0,0 +1,439 @@
+/*
+ * Object caches. See kmem_cache.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+/* Objects are aligned to this; enough for 64-bit fields. */
+#define KMEM_ALIGN 8
+
+/* Empty slabs a cache keeps before giving pages back. */
+#define KMEM_MAXEMPTY 1
+
+/*
+ * A slab is one page: this header, then the objects. The free objects
+ * are kept as a stack of their indexes, rather than by a link in the
+ * objects themselves, so that the objects stay constructed.
+ */
+struct kmem_slab {
+	struct kmem_cache *ks_cache;
+	struct kmem_slab *ks_next;	/* on kc_slabs, if anything is free */
+	struct kmem_slab **ks_pprev;	/* NULL if not on kc_slabs */
+	vaddr_t ks_objs;		/* first object */
+	unsigned ks_nfree;
+	uint16_t ks_free[];		/* free object indexes */
+};
+
+/* All caches, for the statistics. */
+static struct kmem_cache *kmem_caches;
+static struct spinlock kmem_caches_lock = SPINLOCK_INITIALIZER;
+
+static void kmem_slab_putobj(struct kmem_cache *kc, void *obj);
+
+/*
+ * Work out the layout of the cache's slabs.
+ */
+static
+void
+kmem_geometry(struct kmem_cache *kc)
+{
+	size_t objsize;
+	unsigned n;
+
+	KASSERT(kc->kc_size > 0 && kc->kc_size <= KMEM_MAXSIZE);
+	objsize = ROUNDUP(kc->kc_size, KMEM_ALIGN);
+
+	/* as many as fit along with the header and their index */
+	n = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+		(objsize + sizeof(uint16_t));
+	while (ROUNDUP(sizeof(struct kmem_slab) + n * sizeof(uint16_t),
+		       KMEM_ALIGN) + n * objsize > PAGE_SIZE) {
+		n--;
+	}
+	KASSERT(n > 0);
+
+	kc->kc_objsize = objsize;
+	kc->kc_perslab = n;
+}
+
+static
+void
+kmem_list(struct kmem_cache *kc)
+{
+	spinlock_acquire(&kmem_caches_lock);
+	if (!kc->kc_listed) {
+		kc->kc_next = kmem_caches;
+		kmem_caches = kc;
+		kc->kc_listed = true;
+	}
+	spinlock_release(&kmem_caches_lock);
+}
+
+static
+void
+kmem_slab_link(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+	KASSERT(ks->ks_pprev == NULL);
+	ks->ks_next = kc->kc_slabs;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_pprev = &ks->ks_next;
+	}
+	kc->kc_slabs = ks;
+	ks->ks_pprev = &kc->kc_slabs;
+}
+
+static
+void
+kmem_slab_unlink(struct kmem_slab *ks)
+{
+	KASSERT(ks->ks_pprev != NULL);
+	*ks->ks_pprev = ks->ks_next;
+	if (ks->ks_next != NULL) {
+		ks->ks_next->ks_pprev = ks->ks_pprev;
+	}
+	ks->ks_next = NULL;
+	ks->ks_pprev = NULL;
+}
+
+/*
+ * Run the destructor on the first N objects of a slab, and give the
+ * page back.
+ */
+static
+void
+kmem_slab_free(struct kmem_cache *kc, struct kmem_slab *ks, unsigned n)
+{
+	unsigned i;
+
+	if (kc->kc_dtor != NULL) {
+		for (i=0; i<n; i++) {
+			kc->kc_dtor((void *)(ks->ks_objs + i * kc->kc_objsize));
+		}
+	}
+	free_kpages((vaddr_t)ks);
+}
+
+/*
+ * Make a new slab, with all its objects constructed. Called without
+ * the cache's lock, as the constructor may sleep.
+ */
+static
+struct kmem_slab *
+kmem_slab_create(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	vaddr_t page;
+	unsigned i;
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return NULL;
+	}
+	KASSERT(page % PAGE_SIZE == 0);
+
+	ks = (struct kmem_slab *)page;
+	ks->ks_cache = kc;
+	ks->ks_next = NULL;
+	ks->ks_pprev = NULL;
+	ks->ks_objs = page + ROUNDUP(sizeof(struct kmem_slab) +
+				     kc->kc_perslab * sizeof(uint16_t),
+				     KMEM_ALIGN);
+	ks->ks_nfree = kc->kc_perslab;
+
+	for (i=0; i<kc->kc_perslab; i++) {
+		/* hand out the lowest addresses first */
+		ks->ks_free[i] = kc->kc_perslab - 1 - i;
+
+		if (kc->kc_ctor != NULL &&
+		    kc->kc_ctor((void *)(ks->ks_objs + i * kc->kc_objsize))) {
+			kmem_slab_free(kc, ks, i);
+			return NULL;
+		}
+	}
+	return ks;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_slabs = NULL;
+	kc->kc_nslabs = 0;
+	kc->kc_nempty = 0;
+	kc->kc_inuse = 0;
+	kc->kc_ctors = 0;
+	kc->kc_allocs = 0;
+	kc->kc_listed = false;
+	kc->kc_next = NULL;
+	bzero(kc->kc_mags, sizeof(kc->kc_mags));
+	kmem_geometry(kc);
+
+	kmem_list(kc);
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+	struct kmem_slab *ks;
+	unsigned i;
+
+	spinlock_acquire(&kmem_caches_lock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&kmem_caches_lock);
+
+	/* nobody uses the cache any more: empty all the magazines */
+	for (i=0; i<KMEM_MAXCPUS; i++) {
+		while (kc->kc_mags[i].km_count > 0) {
+			kc->kc_mags[i].km_count--;
+			kmem_slab_putobj(kc, kc->kc_mags[i].km_objs[
+						 kc->kc_mags[i].km_count]);
+		}
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_inuse == 0);
+	while ((ks = kc->kc_slabs) != NULL) {
+		KASSERT(ks->ks_nfree == kc->kc_perslab);
+		kmem_slab_unlink(ks);
+		kc->kc_nslabs--;
+		kc->kc_nempty--;
+		spinlock_release(&kc->kc_lock);
+		kmem_slab_free(kc, ks, kc->kc_perslab);
+		spinlock_acquire(&kc->kc_lock);
+	}
+	KASSERT(kc->kc_nslabs == 0);
+	spinlock_release(&kc->kc_lock);
+
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+/*
+ * Get the current cpu's magazine of a cache, or NULL if there isn't
+ * one. Must be called with interrupts off, and the magazine must be
+ * let go of before they go back on.
+ */
+static
+struct kmem_mag *
+kmem_mag_mine(struct kmem_cache *kc)
+{
+	if (!CURCPU_EXISTS() || curcpu->c_number >= KMEM_MAXCPUS) {
+		return NULL;
+	}
+	return &kc->kc_mags[curcpu->c_number];
+}
+
+/*
+ * Get an object from the slabs.
+ */
+static
+void *
+kmem_slab_alloc(struct kmem_cache *kc)
+{
+	struct kmem_slab *ks;
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	if (kc->kc_perslab == 0) {
+		kmem_geometry(kc);
+	}
+	while (kc->kc_slabs == NULL) {
+		spinlock_release(&kc->kc_lock);
+		ks = kmem_slab_create(kc);
+		if (ks == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&kc->kc_lock);
+		kc->kc_ctors += kc->kc_perslab;
+		kc->kc_nslabs++;
+		kc->kc_nempty++;
+		kmem_slab_link(kc, ks);
+	}
+
+	ks = kc->kc_slabs;
+	KASSERT(ks->ks_nfree > 0);
+	if (ks->ks_nfree == kc->kc_perslab) {
+		KASSERT(kc->kc_nempty > 0);
+		kc->kc_nempty--;
+	}
+	ks->ks_nfree--;
+	obj = (void *)(ks->ks_objs + ks->ks_free[ks->ks_nfree] * kc->kc_objsize);
+	if (ks->ks_nfree == 0) {
+		/* full */
+		kmem_slab_unlink(ks);
+	}
+	kc->kc_inuse++;
+	kc->kc_allocs++;
+	spinlock_release(&kc->kc_lock);
+
+	return obj;
+}
+
+/*
+ * Give an object back to its slab.
+ */
+static
+void
+kmem_slab_putobj(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+	vaddr_t offset;
+
+	/* checked by kmem_cache_free */
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	offset = (vaddr_t)obj - ks->ks_objs;
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(ks->ks_nfree < kc->kc_perslab);
+	KASSERT(kc->kc_inuse > 0);
+	ks->ks_free[ks->ks_nfree++] = offset / kc->kc_objsize;
+	kc->kc_inuse--;
+	if (ks->ks_nfree == 1) {
+		/* was full */
+		kmem_slab_link(kc, ks);
+	}
+	if (ks->ks_nfree == kc->kc_perslab) {
+		if (kc->kc_nempty >= KMEM_MAXEMPTY) {
+			kmem_slab_unlink(ks);
+			kc->kc_nslabs--;
+			spinlock_release(&kc->kc_lock);
+			kmem_slab_free(kc, ks, kc->kc_perslab);
+			return;
+		}
+		kc->kc_nempty++;
+	}
+	spinlock_release(&kc->kc_lock);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	struct kmem_mag *mag;
+	void *obj;
+	int spl;
+
+	if (!kc->kc_listed) {
+		/* first use of a static cache */
+		kmem_list(kc);
+	}
+
+	spl = splhigh();
+	mag = kmem_mag_mine(kc);
+	if (mag != NULL && mag->km_count > 0) {
+		obj = mag->km_objs[--mag->km_count];
+		mag->km_allocs++;
+		splx(spl);
+		return obj;
+	}
+	splx(spl);
+
+	return kmem_slab_alloc(kc);
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	struct kmem_slab *ks;
+	vaddr_t offset;
+	struct kmem_mag *mag;
+	void *spill[KMEM_MAGSIZE / 2];
+	unsigned i, nspill;
+	int spl;
+
+	ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	KASSERT(ks->ks_cache == kc);
+	offset = (vaddr_t)obj - ks->ks_objs;
+	if (offset % kc->kc_objsize != 0 ||
+	    offset / kc->kc_objsize >= kc->kc_perslab) {
+		panic("kmem_cache_free: %s: invalid object %p\n",
+		      kc->kc_name, obj);
+	}
+
+	spl = splhigh();
+	mag = kmem_mag_mine(kc);
+	if (mag == NULL) {
+		splx(spl);
+		kmem_slab_putobj(kc, obj);
+		return;
+	}
+	/* when full, give the older half back to the slabs */
+	nspill = 0;
+	if (mag->km_count == KMEM_MAGSIZE) {
+		nspill = KMEM_MAGSIZE / 2;
+		for (i=0; i<nspill; i++) {
+			spill[i] = mag->km_objs[i];
+		}
+		for (i=nspill; i<KMEM_MAGSIZE; i++) {
+			mag->km_objs[i - nspill] = mag->km_objs[i];
+		}
+		mag->km_count -= nspill;
+	}
+	mag->km_objs[mag->km_count++] = obj;
+	splx(spl);
+
+	for (i=0; i<nspill; i++) {
+		kmem_slab_putobj(kc, spill[i]);
+	}
+}
+
+/*
+ * Print the usage of all caches. "waste" is the part of the slab
+ * pages not holding objects in use.
+ */
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+	unsigned long bytes, used;
+	unsigned i, inuse;
+	uint64_t allocs;
+
+	kprintf("Object caches:\n");
+	kprintf("%-16s %5s %5s %5s %6s %7s %5s %9s %10s\n",
+		"name", "size", "slot", "slabs", "objs", "in use", "waste",
+		"ctors", "allocs");
+	spinlock_acquire(&kmem_caches_lock);
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		/* objects in the magazines are free (unlocked reads) */
+		inuse = kc->kc_inuse;
+		allocs = kc->kc_allocs;
+		for (i=0; i<KMEM_MAXCPUS; i++) {
+			inuse -= kc->kc_mags[i].km_count;
+			allocs += kc->kc_mags[i].km_allocs;
+		}
+		bytes = (unsigned long)kc->kc_nslabs * PAGE_SIZE;
+		used = (unsigned long)inuse * kc->kc_size;
+		kprintf("%-16s %5lu %5lu %5u %6u %7u %4lu%% %9u %10llu\n",
+			kc->kc_name, (unsigned long)kc->kc_size,
+			(unsigned long)kc->kc_objsize, kc->kc_nslabs,
+			kc->kc_nslabs * kc->kc_perslab, inuse,
+			bytes ? (bytes - used) * 100 / bytes : 0UL,
+			kc->kc_ctors, allocs);
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kmem_caches_lock);
+}
@@ -6,6 +6,8 @@
 #include <kern/errno.h>
 #include <swapfile.h>
 #include <vm.h>
+#include <coremap.h>
+#include <vmalloc.h>
 #include "opt-swap.h"
 #include "opt-noswap_rdonly.h"
 
@@ -85,8 +87,21 @@ static int pt_get_index(struct addrspace *as, vaddr_t vaddr){
 struct pt_entry *pt_create(unsigned long pagetable_size)
 {
     unsigned long i = 0;
-
-    struct pt_entry *pt = kmalloc(sizeof(struct pt_entry) * pagetable_size);
+    size_t size = sizeof(struct pt_entry) * pagetable_size;
+    struct pt_entry *pt;
+
+    /*
+     * Big tables would need contiguous frames from kmalloc, which
+     * may not be there once user pages are scattered all over RAM.
+     */
+    if (size >= PAGE_SIZE)
+    {
+        pt = vmalloc(size);
+    }
+    else
+    {
+        pt = kmalloc(size);
+    }
 
     if (pt == NULL)
     {
@@ -129,41 +144,30 @@ struct pt_entry *pt_get_entry(struct addrspace *as, const vaddr_t vaddr)
 void pt_destroy(struct pt_entry* entry) 
 {
     KASSERT(entry != NULL);
-    kfree(entry);
+    if (VMALLOC_ADDR((vaddr_t)entry))
+    {
+        vfree(entry);
+    }
+    else
+    {
+        kfree(entry);
+    }
 }
 
 /**
  * @brief deallocates both the pages in memory and the pages 
- * in the swap file.
+ * in the swap file. The coremap does it page by page, as some
+ * of the pages may be in the middle of an eviction.
  * 
  * @param pt 
  * @param size 
  */
 void pt_empty(struct pt_entry* pt, int size){
-    paddr_t paddr;
     KASSERT(pt != NULL);
     KASSERT(pt != 0);
 
     for(int i = 0; i < size; i++){
-        switch (pt[i].pt_status)
-        {
-#if OPT_NOSWAP_RDONLY
-            case IN_MEMORY_RDONLY:
-#endif
-            case IN_MEMORY:
-                paddr = ( pt[i].pt_frame_index ) * PAGE_SIZE;
-                free_upage(paddr);
-                break;
-            case IN_SWAP:
-#if OPT_SWAP       
-                swap_free(pt[i].pt_swap_index);
-#else           
-                panic("SWAP Pages should not exists!");
-#endif
-                break;
-            default:
-                break;
-        }
+        coremap_release_page(&pt[i]);
     }
 
 }
@@ -1,6 +1,10 @@
 #include <segment.h>
 #include <lib.h>
 #include <vm.h>
+#include <kmem_cache.h>
+
+static struct kmem_cache segment_cache =
+    KMEM_CACHE_INITIALIZER("segment", sizeof(struct segment), NULL, NULL);
 
 /**
  * @brief allocates and initializes the segment data structure
@@ -8,7 +12,7 @@
  * @return struct segment* 
  */
 struct segment *segment_create(void){
-    struct segment *seg = kmalloc(sizeof(struct segment));
+    struct segment *seg = kmem_cache_alloc(&segment_cache);
 
     KASSERT(seg != NULL);
 
@@ -69,5 +73,5 @@ void segment_destroy(struct segment *seg){
     
     KASSERT(seg != NULL);
 
-    kfree(seg);
+    kmem_cache_free(&segment_cache, seg);
 }
\ No newline at end of file
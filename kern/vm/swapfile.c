@@ -13,7 +13,7 @@
 
 static struct vnode *swapfile;
 static struct bitmap *swapmap;
-static struct spinlock swaplock = SPINLOCK_INITIALIZER;
+static struct spinlock swaplock = SPINLOCK_TICKET_INITIALIZER;
 
 
 /**
@@ -35,6 +35,8 @@ void swap_bootstrap(void)
     }
 
     swapmap = bitmap_create(SWAPFILE_NPAGES);
+
+    LOCKPROF_SPINLOCK(&swaplock, "swaplock");
 }
 
 
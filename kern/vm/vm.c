@@ -4,21 +4,28 @@
 #include <spl.h>
 #include <cpu.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <proc.h>
 #include <current.h>
+#include <thread.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <pt.h>
 #include <vm.h>
 #include <coremap.h>
 #include <vm_tlb.h>
+#include <synch.h>
 #include "opt-rudevm.h"
 #include "syscall.h"
 #include <swapfile.h>
+#include <vmalloc.h>
+#include <vmtrace.h>
+#include <vminfo.h>
 #include "opt-stats.h"
 #include "opt-noswap_rdonly.h"
 
 #if OPT_STATS
+#include <timer.h>
 #include <vmstats.h>
 #endif
 
@@ -29,9 +36,13 @@
 void
 vm_bootstrap(void)
 {
+#if OPT_STATS
+	vmstats_bootstrap();
+#endif
 #if OPT_SWAP
 	swap_bootstrap();
 #endif
+	vminfo_bootstrap();
 }
 
 /*
@@ -67,7 +78,7 @@ getppages(unsigned long npages, struct pt_entry *ptentry)
 {
 	paddr_t addr;
 
-	addr = coremap_getppages(npages, ptentry);
+	addr = coremap_getppages(npages, ptentry, ptentry == NULL ? NULL : proc_getas());
 	if (addr == 0) {
 		panic("Out of memory");
 	}
@@ -106,8 +117,10 @@ free_kpages(vaddr_t addr)
 }
 
 /**
- * @brief allocate a page for the user. 
+ * @brief allocate a page for the user of the current process. 
  * It is different from the alloc_kpage as it allocate one frame at a time .
+ * The frame is returned pinned, so that it cannot be evicted while it
+ * is being loaded: unpin it with coremap_unpin_frame once mapped.
  * 
  * @return paddr_t the virtual address of the allocated frame
  */
@@ -131,11 +144,82 @@ void free_upage(paddr_t addr){
 	freeppages(addr);
 };
 
+/**
+ * @brief fault in the user page containing vaddr and pin its frame, so
+ * that a driver can move data straight into/out of it through kseg0
+ * without taking page faults (and possibly swapping) in the middle of
+ * the transfer.
+ *
+ * @param as
+ * @param vaddr
+ * @param towrite true if the kernel is going to write into the page.
+ * @param ret physical address of the pinned frame.
+ * @return 0 on success, EFAULT if vaddr is not a valid destination.
+ */
+int
+vm_pin_upage(struct addrspace *as, vaddr_t vaddr, bool towrite, paddr_t *ret)
+{
+	struct pt_entry *pt_row;
+	int seg_type;
+	int result;
+
+	vm_can_sleep();
+	KASSERT(as != NULL);
+
+	seg_type = as_get_segment_type(as, vaddr);
+	if (seg_type == 0 || (towrite && seg_type == SEGMENT_TEXT)) {
+		return EFAULT;
+	}
+
+	pt_row = pt_get_entry(as, vaddr);
+	while (!coremap_pin_frame(pt_row)) {
+		if (pt_row->pt_status == IN_MEMORY || pt_row->pt_status == IN_MEMORY_RDONLY) {
+			/* the frame is being swapped out: wait for it */
+			thread_yield();
+		}
+		else {
+			result = vm_fault(towrite ? VM_FAULT_WRITE : VM_FAULT_READ, vaddr);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	*ret = pt_row->pt_frame_index * PAGE_SIZE;
+	return 0;
+}
+
+/**
+ * @brief unpin a frame pinned by vm_pin_upage.
+ *
+ * @param paddr
+ */
+void
+vm_unpin_upage(paddr_t paddr)
+{
+	coremap_unpin_frame(paddr & PAGE_FRAME);
+}
+
+/**
+ * @brief drop the local TLB mapping of a frame, on request of another
+ * CPU that is evicting it.
+ *
+ * @param ts
+ */
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("vm tried to do tlb shootdown?!\n");
+	tlb_remove_by_paddr(ts->ts_paddr);
+}
+
+/**
+ * @brief flush the local TLB, when too many shootdowns were queued to
+ * handle them one by one.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	tlb_invalidate();
 }
 
 int
@@ -147,6 +231,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	int seg_type;
 	int readonly;
 	vaddr_t basefaultaddr;
+#if OPT_STATS
+	uint64_t start = 0;
+	unsigned latkind = VMLAT_ZERO;
+#endif
+
+	/* kernel memory from vmalloc: no process involved, not counted */
+	if (VMALLOC_ADDR(faultaddress)) {
+		return vmalloc_fault(faulttype, faultaddress);
+	}
 
 #if OPT_STATS
 	vmstats_hit(VMSTAT_TLB_FAULT);
@@ -188,6 +281,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		return EFAULT;
 	}
 
+	VMTRACE(VMT_FAULT, faulttype, as, faultaddress, 0);
+
 	/* Assert that the address space has been set up properly. */
 	KASSERT(as->as_data != NULL);
 	KASSERT(as->as_stack != NULL);
@@ -197,56 +292,126 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/**
 	 * If as_get_segment_type returns zero, the fault address
 	 * does not belong to a valid segment.
+	 * sys__exit ends the whole process, whichever thread faulted.
 	 */
 	if(!(seg_type = as_get_segment_type(as, faultaddress))){
 		kprintf("vm: got faultaddr out of range, process killed\n");
 		sys__exit(-1);
 	}
+
 	pt_row = pt_get_entry(as, faultaddress);
 	readonly = seg_type == SEGMENT_TEXT;
+
+	/**
+	 * resident page: just reload the TLB. coremap_tlb_reload checks
+	 * the page under the coremap lock, so this needs no as_faultsem
+	 * and the threads of a process can take TLB refills in parallel.
+	 * A page is only marked resident once its contents are in place.
+	 */
+	if (coremap_tlb_reload(pt_row, basefaultaddr, readonly,
+			       &as->as_faults[AS_FAULT_RELOAD])) {
+		VMTRACE(VMT_RESOLVE, VMT_PATH_RELOAD, as, basefaultaddr,
+			pt_row->pt_frame_index * PAGE_SIZE);
+#if OPT_STATS
+		vmstats_hit(VMSTAT_TLB_RELOAD);
+#endif
+		return 0;
+	}
+
+	/**
+	 * threads of the same process share the page table: only
+	 * one of them at a time can load a page.
+	 */
+	P(as->as_faultsem);
+
 	switch(pt_row->pt_status)
 	{
 		case NOT_LOADED:
+#if OPT_STATS
+			/* time the page faults, from here to the TLB insertion */
+			start = timer_now();
+#endif
 			/*	alloc a page				*/
 			page_paddr = alloc_upage(pt_row);
 
 			/**  
-			 * update page table.			
+			 * record the frame in the page table.
 			 * it is important to do it before as_load_page
 			 * as the pt_entry will be used to retrieve the
-			 * physical address of the page
+			 * physical address of the page. The page stays
+			 * NOT_LOADED until it is filled: the lock-free
+			 * paths (coremap_tlb_reload, coremap_pin_frame)
+			 * must not map it, and the other threads wait
+			 * on as_faultsem meanwhile.
 			 */
-			pt_set_entry(pt_row,page_paddr,0, (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY); 	
+			pt_set_entry(pt_row,page_paddr,0,NOT_LOADED);
 
 			/*	load the page if needed 	*/
 			if(seg_type != SEGMENT_STACK && as_check_in_elf(as,faultaddress))
 			{
 				as_load_page(as,curproc->p_vnode,faultaddress);
-			}
+				VMTRACE(VMT_RESOLVE, VMT_PATH_ELF, as, basefaultaddr, page_paddr);
+				as->as_faults[AS_FAULT_ELF]++;
 #if OPT_STATS
+				latkind = VMLAT_ELF;
+#endif
+			}
 			else
 			{
+				VMTRACE(VMT_RESOLVE, VMT_PATH_ZERO, as, basefaultaddr, page_paddr);
+				as->as_faults[AS_FAULT_ZERO]++;
+#if OPT_STATS
     			vmstats_hit(VMSTAT_PAGE_FAULT_ZERO);
-			}
+				latkind = VMLAT_ZERO;
 #endif
+			}
+
+			/*	loaded: now the page can be used	*/
+			membar_store_store();
+			pt_set_entry(pt_row,page_paddr,0, (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY);
 			break;
 		case IN_MEMORY_RDONLY:
 		case IN_MEMORY:
+			/**
+			 * loaded by another thread meanwhile, or being
+			 * evicted: reload the mapping, or in the second
+			 * case give the eviction time to complete and let
+			 * the access fault again.
+			 */
+			if (!coremap_tlb_reload(pt_row, basefaultaddr, readonly,
+						&as->as_faults[AS_FAULT_RELOAD])) {
+				VMTRACE(VMT_RESOLVE, VMT_PATH_RETRY, as, basefaultaddr, 0);
+				V(as->as_faultsem);
+				thread_yield();
+				return 0;
+			}
+			VMTRACE(VMT_RESOLVE, VMT_PATH_RELOAD, as, basefaultaddr,
+				pt_row->pt_frame_index * PAGE_SIZE);
 #if OPT_STATS
     		vmstats_hit(VMSTAT_TLB_RELOAD);
 #endif
-			break;
+			V(as->as_faultsem);
+			return 0;
 		case IN_SWAP:
+#if OPT_STATS
+			start = timer_now();
+#endif
 #if OPT_SWAP
 			/*	alloc the page				*/
 			page_paddr = alloc_upage(pt_row);
 
 			/*	swap it from the elf file into memory	*/
+			VMTRACE(VMT_SWAPIN, 0, as, pt_row->pt_swap_index, page_paddr);
 			swap_in(page_paddr, pt_row->pt_swap_index);
+			VMTRACE(VMT_RESOLVE, VMT_PATH_SWAP, as, basefaultaddr, page_paddr);
+			as->as_faults[AS_FAULT_SWAP]++;
 
 			/* update page table	*/
-			
+			membar_store_store();
 			pt_set_entry(pt_row,page_paddr,0, (OPT_NOSWAP_RDONLY && readonly) ? IN_MEMORY_RDONLY : IN_MEMORY); 
+#if OPT_STATS
+			latkind = VMLAT_SWAPIN;
+#endif
 
 #else
 			panic("swap not implemented!");
@@ -260,6 +425,14 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	/* update tlb	*/
 	tlb_insert(basefaultaddr, pt_row->pt_frame_index * PAGE_SIZE, readonly); 
+#if OPT_STATS
+	vmstats_latency(latkind, timer_now() - start);
+#endif
+
+	/* now the frame can be chosen as a victim */
+	coremap_unpin_frame(pt_row->pt_frame_index * PAGE_SIZE);
+
+	V(as->as_faultsem);
 
 	return 0;
 }
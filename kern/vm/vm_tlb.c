@@ -3,6 +3,7 @@
 #include <spl.h>
 #include <vm.h>
 #include <lib.h>
+#include <vmtrace.h>
 #include "opt-stats.h"
 #if OPT_STATS
 #include <vmstats.h>
@@ -11,12 +12,13 @@
 int tlb_victim = 0;
 bool tlb_free = true;
 
-void tlb_invalidate(void)
+/*
+ * Invalidate all the slots, and nothing else: no stats, no trace.
+ * Called with interrupts off.
+ */
+static void tlb_clear(void)
 {
-    int spl, i;
-
-    /* Disable interrupts on this CPU while frobbing the TLB. */
-    spl = splhigh();
+    int i;
 
     for (i = 0; i < NUM_TLB; i++)
     {
@@ -25,6 +27,18 @@ void tlb_invalidate(void)
 
     tlb_victim = 0;
     tlb_free = true;
+}
+
+void tlb_invalidate(void)
+{
+    int spl;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+
+    tlb_clear();
+
+    VMTRACE(VMT_TLBFLUSH, 0, NULL, 0, 0);
 
 #if OPT_STATS
     vmstats_hit(VMSTAT_TLB_INVALIDATION);
@@ -33,17 +47,19 @@ void tlb_invalidate(void)
     splx(spl);
 }
 
-void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro)
+/*
+ * Write the mapping in the next slot, round robin, and nothing else:
+ * no stats, no trace. Returns true if the slot was free. Called with
+ * interrupts off.
+ */
+static bool tlb_write_next(vaddr_t vaddr, paddr_t paddr, bool ro)
 {
-    int spl;
     uint32_t ehi, elo;
+    bool wasfree;
 
     /* Make sure it's page-aligned */
     KASSERT((paddr & PAGE_FRAME) == paddr);
 
-    /* Disable interrupts on this CPU while frobbing the TLB. */
-    spl = splhigh();
-
     ehi = vaddr;
     elo = paddr | TLBLO_VALID;
     if (!ro)
@@ -53,8 +69,42 @@ void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro)
     tlb_write(ehi, elo, tlb_victim);
     tlb_victim = (tlb_victim + 1) % NUM_TLB;
 
+    wasfree = tlb_free;
+    if(tlb_victim == 0)
+    {
+        tlb_free = false;
+    }
+    return wasfree;
+}
+
+/*
+ * tlb_write_next, traced.
+ */
+static bool tlb_write_traced(vaddr_t vaddr, paddr_t paddr, bool ro)
+{
+    int slot;
+    bool wasfree;
+
+    slot = tlb_victim;
+    wasfree = tlb_write_next(vaddr, paddr, ro);
+    VMTRACE(VMT_TLB, slot | (wasfree ? 0 : VMT_TLB_REPLACED), NULL,
+            vaddr, paddr);
+    (void)slot;
+    return wasfree;
+}
+
+void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro)
+{
+    int spl;
+    bool wasfree;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+
+    wasfree = tlb_write_traced(vaddr, paddr, ro);
+
 #if OPT_STATS
-    if(tlb_free)
+    if(wasfree)
     {
 	    vmstats_hit(VMSTAT_TLB_FAULT_FREE);
     }
@@ -62,26 +112,57 @@ void tlb_insert(vaddr_t vaddr, paddr_t paddr, bool ro)
     {
         vmstats_hit(VMSTAT_TLB_FAULT_REPLACE);
     }
+#else
+    (void)wasfree;
 #endif
-    if(tlb_victim == 0)
-    {
-        tlb_free = false;
-    }
 
     splx(spl);
 }
 
+void tlb_insert_kernel(vaddr_t vaddr, paddr_t paddr)
+{
+    int spl;
+
+    spl = splhigh();
+    tlb_write_traced(vaddr, paddr, false);
+    splx(spl);
+}
+
+void tlb_insert_raw(vaddr_t vaddr, paddr_t paddr, bool ro)
+{
+    int spl;
+
+    spl = splhigh();
+    tlb_write_next(vaddr, paddr, ro);
+    splx(spl);
+}
+
+void tlb_invalidate_raw(void)
+{
+    int spl;
+
+    spl = splhigh();
+    tlb_clear();
+    splx(spl);
+}
+
 
 void tlb_remove_by_paddr(paddr_t paddr) {
-    
+    int spl;
+
     KASSERT(paddr % PAGE_SIZE == 0);
 
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+
     for (int i = 0; i < NUM_TLB; i++) {
         uint32_t ehi, elo;
         tlb_read(&ehi, &elo, i);
         if (paddr == (elo & PAGE_FRAME)) {
             tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-            return;
+            break;
         }
     }
+
+    splx(spl);
 }
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <vm.h>
+#include <coremap.h>
+#include <vm_tlb.h>
+#include <vmalloc.h>
+
+/*
+ * The vmalloc area is described by one word per page: the frame that
+ * is mapped there and some flags, or 0 if the page is free. Entries
+ * are changed under vmalloc_lock, but vmalloc_fault reads them
+ * without it: it may be called with any spinlock held, including
+ * this one.
+ */
+#define VMAP_MAPPED	0x1	/* mapped to the frame */
+#define VMAP_LAST	0x2	/* last page of an allocation */
+#define VMAP_RESERVED	0x4	/* taken, but not (or no longer) mapped */
+
+static uint32_t vmalloc_map[VMALLOC_NPAGES];
+static unsigned vmalloc_next;	/* where to start looking */
+static struct spinlock vmalloc_lock = SPINLOCK_INITIALIZER;
+
+/**
+ * @brief find and reserve NPAGES free pages of the vmalloc area.
+ *
+ * @param npages
+ * @return the index of the first page, or -1 if there is no room.
+ */
+static
+int
+vmalloc_reserve(unsigned npages)
+{
+	unsigned start, run, i, tries;
+
+	spinlock_acquire(&vmalloc_lock);
+
+	/* next fit: go around the area once, from where we left off */
+	start = vmalloc_next;
+	run = 0;
+	for (tries = 0; tries < VMALLOC_NPAGES + npages; tries++) {
+		i = (vmalloc_next + tries) % VMALLOC_NPAGES;
+		if (i == 0) {
+			/* runs can't wrap around the end */
+			run = 0;
+		}
+		if (vmalloc_map[i] != 0) {
+			run = 0;
+			continue;
+		}
+		if (run == 0) {
+			start = i;
+		}
+		run++;
+		if (run == npages) {
+			for (i = start; i < start + npages; i++) {
+				vmalloc_map[i] = VMAP_RESERVED;
+			}
+			vmalloc_next = (start + npages) % VMALLOC_NPAGES;
+			spinlock_release(&vmalloc_lock);
+			return start;
+		}
+	}
+
+	spinlock_release(&vmalloc_lock);
+	return -1;
+}
+
+/**
+ * @brief give back pages of the vmalloc area, freeing the frames that
+ * were mapped there. The pages must no longer be in any TLB.
+ *
+ * @param start first page.
+ * @param npages
+ * @param frames the frames, or NULL if none were mapped yet.
+ * @param nframes number of frames to free.
+ */
+static
+void
+vmalloc_release(unsigned start, unsigned npages, const paddr_t *frames,
+		unsigned nframes)
+{
+	unsigned i;
+
+	spinlock_acquire(&vmalloc_lock);
+	for (i = start; i < start + npages; i++) {
+		KASSERT(vmalloc_map[i] == VMAP_RESERVED);
+		vmalloc_map[i] = 0;
+	}
+	spinlock_release(&vmalloc_lock);
+
+	for (i = 0; i < nframes; i++) {
+		coremap_freeppages(frames[i]);
+	}
+}
+
+void *
+vmalloc(size_t size)
+{
+	unsigned npages, i;
+	paddr_t pa;
+	int start;
+
+	npages = DIVROUNDUP(size, PAGE_SIZE);
+	if (npages == 0 || npages > VMALLOC_NPAGES) {
+		return NULL;
+	}
+
+	start = vmalloc_reserve(npages);
+	if (start < 0) {
+		kprintf("vmalloc: out of kernel address space\n");
+		return NULL;
+	}
+
+	/* one frame at a time: they need not be contiguous */
+	for (i = 0; i < npages; i++) {
+		pa = coremap_getppages(1, NULL, NULL);
+		if (pa == 0) {
+			break;
+		}
+		/* not visible to anyone yet, so no need to lock */
+		vmalloc_map[start + i] = pa | VMAP_RESERVED;
+	}
+
+	if (i < npages) {
+		/* out of memory: undo */
+		while (i-- > 0) {
+			coremap_freeppages(vmalloc_map[start + i] & PAGE_FRAME);
+			vmalloc_map[start + i] = VMAP_RESERVED;
+		}
+		vmalloc_release(start, npages, NULL, 0);
+		return NULL;
+	}
+
+	spinlock_acquire(&vmalloc_lock);
+	for (i = 0; i < npages; i++) {
+		vmalloc_map[start + i] = (vmalloc_map[start + i] & PAGE_FRAME)
+			| VMAP_MAPPED;
+	}
+	vmalloc_map[start + npages - 1] |= VMAP_LAST;
+	spinlock_release(&vmalloc_lock);
+
+	return (void *)(VMALLOC_BASE + start * PAGE_SIZE);
+}
+
+void
+vfree(void *ptr)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	paddr_t frames[TLBSHOOTDOWN_MAX];
+	vaddr_t va = (vaddr_t)ptr;
+	unsigned start, i, n;
+	bool last;
+
+	KASSERT(VMALLOC_ADDR(va));
+	KASSERT(va % PAGE_SIZE == 0);
+	start = (va - VMALLOC_BASE) / PAGE_SIZE;
+	if (!(vmalloc_map[start] & VMAP_MAPPED) ||
+	    (start > 0 && (vmalloc_map[start - 1] & VMAP_MAPPED) &&
+	     !(vmalloc_map[start - 1] & VMAP_LAST))) {
+		panic("vfree: %p was not allocated by vmalloc\n", ptr);
+	}
+
+	/*
+	 * Unmap a batch of pages at a time: take them out of the map,
+	 * but keep them reserved until no TLB has them any more, then
+	 * free the frames and the pages.
+	 */
+	last = false;
+	while (!last) {
+		spinlock_acquire(&vmalloc_lock);
+		for (n = 0; n < TLBSHOOTDOWN_MAX && !last; n++) {
+			KASSERT(vmalloc_map[start + n] & VMAP_MAPPED);
+			last = (vmalloc_map[start + n] & VMAP_LAST) != 0;
+			frames[n] = vmalloc_map[start + n] & PAGE_FRAME;
+			vmalloc_map[start + n] = VMAP_RESERVED;
+		}
+		spinlock_release(&vmalloc_lock);
+
+		for (i = 0; i < n; i++) {
+			ts[i].ts_paddr = frames[i];
+			ts[i].ts_as = NULL;	/* kernel: every cpu */
+		}
+		ipi_tlbshootdown_sync(ts, n);
+
+		vmalloc_release(start, n, frames, n);
+		start += n;
+	}
+}
+
+/**
+ * @brief resolve a TLB fault on a vmalloc address.
+ *
+ * @param faulttype
+ * @param faultaddress
+ * @return 0 on success, EFAULT if the address is not mapped.
+ */
+int
+vmalloc_fault(int faulttype, vaddr_t faultaddress)
+{
+	uint32_t entry;
+
+	KASSERT(VMALLOC_ADDR(faultaddress));
+
+	if (faulttype == VM_FAULT_READONLY) {
+		/* vmalloc pages are never read-only */
+		return EFAULT;
+	}
+
+	entry = vmalloc_map[(faultaddress - VMALLOC_BASE) / PAGE_SIZE];
+	if (!(entry & VMAP_MAPPED)) {
+		return EFAULT;
+	}
+
+	tlb_insert_kernel(faultaddress & PAGE_FRAME, entry & PAGE_FRAME);
+	return 0;
+}
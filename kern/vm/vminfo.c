@@ -0,0 +1,259 @@
+/*
+ * VM introspection. See vminfo.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <stdarg.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <device.h>
+#include <mainbus.h>
+#include <vm.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <segment.h>
+#include <pt.h>
+#include <coremap.h>
+#include <vminfo.h>
+
+/* a read of vminfo: gets at most this much of the report */
+#define VMINFO_BUFSIZE (16 * 1024)
+
+/* frames per line of the coremap map */
+#define VMINFO_MAPWIDTH 64
+
+/*
+ * Where the report goes: the console if vo_buf is NULL, otherwise
+ * vo_buf, silently truncated when full.
+ */
+struct vminfo_out {
+	char *vo_buf;
+	size_t vo_len;
+	size_t vo_size;
+};
+
+static
+void
+vminfo_printf(struct vminfo_out *out, const char *fmt, ...)
+{
+	char line[128];
+	va_list ap;
+	size_t len;
+
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+
+	if (out->vo_buf == NULL) {
+		kprintf("%s", line);
+		return;
+	}
+
+	len = strlen(line);
+	if (len > out->vo_size - out->vo_len) {
+		len = out->vo_size - out->vo_len;
+	}
+	memcpy(out->vo_buf + out->vo_len, line, len);
+	out->vo_len += len;
+}
+
+/*
+ * Print a segment, and the state of its pages, which are the NPAGES
+ * entries of the page table starting at PT.
+ */
+static
+void
+vminfo_segment(struct vminfo_out *out, const char *name,
+	       struct segment *seg, struct pt_entry *pt)
+{
+	unsigned counts[4] = { 0, 0, 0, 0 };
+	size_t i;
+
+	for (i = 0; i < seg->seg_npages; i++) {
+		counts[pt[i].pt_status]++;
+	}
+
+	vminfo_printf(out, "  %-6s 0x%08x %7u %10u %9u %6u %7u\n", name,
+		      seg->seg_first_vaddr, seg->seg_npages,
+		      counts[NOT_LOADED], counts[IN_MEMORY],
+		      counts[IN_MEMORY_RDONLY], counts[IN_SWAP]);
+}
+
+/*
+ * Print a process, if it has a complete address space. The page states
+ * are read without the fault semaphore, so they may be slightly stale.
+ */
+static
+void
+vminfo_proc(struct proc *proc, void *data)
+{
+	struct vminfo_out *out = data;
+	struct addrspace *as = proc->p_addrspace;
+	struct pt_entry *pt;
+
+	if (as == NULL || as->as_ptable == NULL) {
+		/* kernel, or still being loaded */
+		return;
+	}
+	pt = as->as_ptable;
+
+	vminfo_printf(out, "%s (%u threads)\n", proc->p_name,
+		      proc->p_numthreads);
+	vminfo_printf(out, "  %-6s %10s %7s %10s %9s %6s %7s\n", "seg",
+		      "first", "npages", "not loaded", "in memory", "rdonly",
+		      "in swap");
+	vminfo_segment(out, "text", as->as_text, pt);
+	pt += as->as_text->seg_npages;
+	vminfo_segment(out, "data", as->as_data, pt);
+	pt += as->as_data->seg_npages;
+	vminfo_segment(out, "stack", as->as_stack, pt);
+	vminfo_printf(out, "  faults: %u zero-fill, %u elf, %u swap-in, "
+		      "%u reload\n", as->as_faults[AS_FAULT_ZERO],
+		      as->as_faults[AS_FAULT_ELF], as->as_faults[AS_FAULT_SWAP],
+		      as->as_faults[AS_FAULT_RELOAD]);
+}
+
+/*
+ * Print the state of each frame, VMINFO_MAPWIDTH to a line.
+ */
+static
+void
+vminfo_coremap(struct vminfo_out *out)
+{
+	unsigned counts[256];
+	char line[VMINFO_MAPWIDTH + 1];
+	char *map;
+	unsigned nframes, i, n;
+
+	nframes = mainbus_ramsize() / PAGE_SIZE;
+	map = kmalloc(nframes);
+	if (map == NULL) {
+		vminfo_printf(out, "coremap: out of memory\n");
+		return;
+	}
+	nframes = coremap_occupancy(map, nframes);
+
+	bzero(counts, sizeof(counts));
+	for (i = 0; i < nframes; i++) {
+		counts[(unsigned char)map[i]]++;
+	}
+
+	vminfo_printf(out, "coremap: %u frames, %u kernel (%c), %u user (%c), "
+		      "%u locked (%c), %u free (%c)\n", nframes,
+		      counts[COREMAP_KERNEL], COREMAP_KERNEL,
+		      counts[COREMAP_USER], COREMAP_USER,
+		      counts[COREMAP_LOCKED], COREMAP_LOCKED,
+		      counts[COREMAP_FREE], COREMAP_FREE);
+	for (i = 0; i < nframes; i += VMINFO_MAPWIDTH) {
+		n = nframes - i < VMINFO_MAPWIDTH ? nframes - i
+			: VMINFO_MAPWIDTH;
+		memcpy(line, map + i, n);
+		line[n] = 0;
+		vminfo_printf(out, "  %5u %s\n", i, line);
+	}
+
+	kfree(map);
+}
+
+static
+void
+vminfo_report(struct vminfo_out *out)
+{
+	proc_foreach(vminfo_proc, out);
+	vminfo_coremap(out);
+}
+
+void
+vminfo_print(void)
+{
+	struct vminfo_out out = { NULL, 0, 0 };
+
+	vminfo_report(&out);
+}
+
+/*
+ * The vminfo: device. Each read makes a fresh report and returns the
+ * part of it at the read's offset.
+ */
+static
+int
+vminfo_eachopen(struct device *dev, int openflags)
+{
+	(void)dev;
+
+	if (openflags != O_RDONLY) {
+		return EIO;
+	}
+	return 0;
+}
+
+static
+int
+vminfo_io(struct device *dev, struct uio *uio)
+{
+	struct vminfo_out out;
+	int result;
+
+	(void)dev;
+
+	KASSERT(uio->uio_rw == UIO_READ);
+
+	out.vo_buf = kmalloc(VMINFO_BUFSIZE);
+	if (out.vo_buf == NULL) {
+		return ENOMEM;
+	}
+	out.vo_len = 0;
+	out.vo_size = VMINFO_BUFSIZE;
+	vminfo_report(&out);
+
+	result = 0;
+	if (uio->uio_offset < (off_t)out.vo_len) {
+		result = uiomove(out.vo_buf + uio->uio_offset,
+				 out.vo_len - uio->uio_offset, uio);
+	}
+
+	kfree(out.vo_buf);
+	return result;
+}
+
+static
+int
+vminfo_ioctl(struct device *dev, int op, userptr_t data)
+{
+	(void)dev;
+	(void)op;
+	(void)data;
+
+	return EINVAL;
+}
+
+static const struct device_ops vminfo_devops = {
+	.devop_eachopen = vminfo_eachopen,
+	.devop_io = vminfo_io,
+	.devop_ioctl = vminfo_ioctl,
+};
+
+void
+vminfo_bootstrap(void)
+{
+	struct device *dev;
+	int result;
+
+	dev = kmalloc(sizeof(*dev));
+	if (dev == NULL) {
+		panic("Could not add vminfo device: out of memory\n");
+	}
+	dev->d_ops = &vminfo_devops;
+	dev->d_blocks = 0;
+	dev->d_blocksize = 1;
+	dev->d_devnumber = 0;	/* assigned by vfs_adddev */
+	dev->d_data = NULL;
+
+	result = vfs_adddev("vminfo", dev, 0);
+	if (result) {
+		panic("Could not add vminfo device: %s\n", strerror(result));
+	}
+}
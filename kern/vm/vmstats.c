@@ -1,13 +1,43 @@
 #include <types.h>
-#include <synch.h>
 #include <spl.h>
+#include <cpu.h>
+#include <current.h>
 #include <lib.h>
 #include <vmstats.h>
 
-static int vmstats[10];
-static struct spinlock vmstats_l = SPINLOCK_INITIALIZER;
+/* sys161 has at most 32 cpus */
+#define VMSTATS_MAXCPUS 32
 
-static const char *vmstats_names[] = {
+/* latency bucket b counts the events that took [2^b, 2^(b+1)) ns */
+#define VMLAT_NBUCKETS 40
+
+/**
+ * @brief the counters of one cpu. Only that cpu writes them, with
+ * interrupts off, so a 64-bit increment can't be torn by another
+ * writer; a reader on another cpu may see a stale value, which is ok
+ * for statistics.
+ */
+struct vmstats_cpu {
+    uint64_t vc_count[VMSTAT_COUNT];
+    uint32_t vc_lat[VMLAT_COUNT][VMLAT_NBUCKETS];
+    uint64_t vc_latsum[VMLAT_COUNT];
+    uint64_t vc_latmax[VMLAT_COUNT];
+};
+
+/**
+ * @brief the latencies of one kind, added up over all the cpus.
+ */
+struct vmstats_lat {
+    uint32_t vl_count;
+    uint64_t vl_mean;
+    uint64_t vl_p50;
+    uint64_t vl_p99;
+    uint64_t vl_max;
+};
+
+static struct vmstats_cpu vmstats[VMSTATS_MAXCPUS];
+
+static const char *vmstats_names[VMSTAT_COUNT] = {
     "TLB Faults",
     "TLB Faults with Free",
     "TLB Faults with Replace",
@@ -19,24 +49,240 @@ static const char *vmstats_names[] = {
     "Page Faults from Swapfile",
     "Swapfile Writes"};
 
+/* the keys of vmstats_dump */
+static const char *vmstats_keys[VMSTAT_COUNT] = {
+    "tlb_faults",
+    "tlb_faults_free",
+    "tlb_faults_replace",
+    "tlb_invalidations",
+    "tlb_reloads",
+    "page_faults_zeroed",
+    "page_faults_disk",
+    "page_faults_elf",
+    "page_faults_swap",
+    "swap_writes"};
+
+static const char *vmlat_names[VMLAT_COUNT] = {
+    "zero-fill",
+    "elf load",
+    "swap-in",
+    "eviction"};
+
+static const char *vmlat_keys[VMLAT_COUNT] = {
+    "zero",
+    "elf",
+    "swapin",
+    "evict"};
+
+void vmstats_bootstrap(void)
+{
+    vmstats_reset();
+}
+
 void vmstats_hit(unsigned int stat)
 {
-    spinlock_acquire(&vmstats_l);
+    unsigned cpu;
+    int spl;
+
+    KASSERT(stat < VMSTAT_COUNT);
+
+    /* stay on this cpu while updating its counter */
+    spl = splhigh();
+    cpu = CURCPU_EXISTS() ? curcpu->c_number % VMSTATS_MAXCPUS : 0;
+    vmstats[cpu].vc_count[stat]++;
+    splx(spl);
+}
+
+/**
+ * @brief record an event of kind KIND that took NS nanoseconds.
+ *
+ * @param kind
+ * @param ns
+ */
+void vmstats_latency(unsigned int kind, uint64_t ns)
+{
+    struct vmstats_cpu *vc;
+    unsigned bucket;
+    int spl;
+
+    KASSERT(kind < VMLAT_COUNT);
+
+    /* log2, by halves: the high word first */
+    bucket = 0;
+    if (ns >> 32)
+    {
+        bucket = 32;
+    }
+    while (bucket < VMLAT_NBUCKETS - 1 && (ns >> (bucket + 1)) != 0)
+    {
+        bucket++;
+    }
+
+    spl = splhigh();
+    vc = &vmstats[CURCPU_EXISTS() ? curcpu->c_number % VMSTATS_MAXCPUS : 0];
+    vc->vc_lat[kind][bucket]++;
+    vc->vc_latsum[kind] += ns;
+    if (ns > vc->vc_latmax[kind])
+    {
+        vc->vc_latmax[kind] = ns;
+    }
+    splx(spl);
+}
+
+/**
+ * @brief add up the latency histograms of a kind over all the cpus.
+ * The percentiles are the upper ends of the buckets they fall in.
+ *
+ * @param kind
+ * @param vl
+ */
+static void vmstats_getlat(unsigned int kind, struct vmstats_lat *vl)
+{
+    uint32_t buckets[VMLAT_NBUCKETS];
+    uint64_t sum = 0;
+    uint32_t seen, p50, p99;
+    unsigned i, b;
+
+    vl->vl_count = 0;
+    vl->vl_max = 0;
+    for (b = 0; b < VMLAT_NBUCKETS; b++)
+    {
+        buckets[b] = 0;
+    }
+    for (i = 0; i < VMSTATS_MAXCPUS; i++)
+    {
+        for (b = 0; b < VMLAT_NBUCKETS; b++)
+        {
+            buckets[b] += vmstats[i].vc_lat[kind][b];
+            vl->vl_count += vmstats[i].vc_lat[kind][b];
+        }
+        sum += vmstats[i].vc_latsum[kind];
+        if (vmstats[i].vc_latmax[kind] > vl->vl_max)
+        {
+            vl->vl_max = vmstats[i].vc_latmax[kind];
+        }
+    }
+
+    vl->vl_mean = vl->vl_p50 = vl->vl_p99 = 0;
+    if (vl->vl_count == 0)
+    {
+        return;
+    }
+    vl->vl_mean = sum / vl->vl_count;
+
+    /* the rank of each percentile, rounded up */
+    p50 = vl->vl_count - vl->vl_count / 2;
+    p99 = vl->vl_count - vl->vl_count / 100;
+    seen = 0;
+    for (b = 0; b < VMLAT_NBUCKETS; b++)
+    {
+        seen += buckets[b];
+        if (vl->vl_p50 == 0 && seen >= p50)
+        {
+            vl->vl_p50 = (uint64_t)2 << b;
+        }
+        if (seen >= p99)
+        {
+            vl->vl_p99 = (uint64_t)2 << b;
+            break;
+        }
+    }
+    /* no point in saying more than the max */
+    if (vl->vl_p50 > vl->vl_max)
+    {
+        vl->vl_p50 = vl->vl_max;
+    }
+    if (vl->vl_p99 > vl->vl_max)
+    {
+        vl->vl_p99 = vl->vl_max;
+    }
+}
+
+/**
+ * @brief add up a counter over all the cpus.
+ *
+ * @param stat
+ * @return uint64_t
+ */
+uint64_t vmstats_get(unsigned int stat)
+{
+    uint64_t total = 0;
 
-    KASSERT(stat < 10);
-    vmstats[stat]++;
+    KASSERT(stat < VMSTAT_COUNT);
 
-    spinlock_release(&vmstats_l);
+    for (unsigned i = 0; i < VMSTATS_MAXCPUS; i++)
+    {
+        total += vmstats[i].vc_count[stat];
+    }
+    return total;
 }
 
-void vmstats_print()
+/**
+ * @brief zero all the counters. Hits counted on other cpus while this
+ * runs may be lost.
+ */
+void vmstats_reset(void)
 {
+    for (unsigned i = 0; i < VMSTATS_MAXCPUS; i++)
+    {
+        for (unsigned j = 0; j < VMSTAT_COUNT; j++)
+        {
+            vmstats[i].vc_count[j] = 0;
+        }
+        for (unsigned j = 0; j < VMLAT_COUNT; j++)
+        {
+            for (unsigned b = 0; b < VMLAT_NBUCKETS; b++)
+            {
+                vmstats[i].vc_lat[j][b] = 0;
+            }
+            vmstats[i].vc_latsum[j] = 0;
+            vmstats[i].vc_latmax[j] = 0;
+        }
+    }
+}
+
+void vmstats_print(void)
+{
+    struct vmstats_lat vl;
+
     kprintf("---------------------------\n");
     kprintf("VM STATS\n");
     kprintf("---------------------------\n");
-    for (int i = 0; i < 10; i++)
+    for (unsigned i = 0; i < VMSTAT_COUNT; i++)
+    {
+        kprintf("%s: %llu\n", vmstats_names[i], vmstats_get(i));
+    }
+    kprintf("---------------------------\n");
+    kprintf("FAULT LATENCY (ns)\n");
+    kprintf("---------------------------\n");
+    kprintf("%-10s %8s %10s %10s %10s %10s\n",
+            "", "count", "mean", "p50", "p99", "max");
+    for (unsigned i = 0; i < VMLAT_COUNT; i++)
     {
-        kprintf("%s: %d\n", vmstats_names[i], vmstats[i]);
+        vmstats_getlat(i, &vl);
+        kprintf("%-10s %8u %10llu %10llu %10llu %10llu\n", vmlat_names[i],
+                vl.vl_count, vl.vl_mean, vl.vl_p50, vl.vl_p99, vl.vl_max);
     }
     kprintf("---------------------------\n");
-}
\ No newline at end of file
+}
+
+void vmstats_dump(void)
+{
+    struct vmstats_lat vl;
+
+    kprintf("vmstats begin\n");
+    for (unsigned i = 0; i < VMSTAT_COUNT; i++)
+    {
+        kprintf("%s=%llu\n", vmstats_keys[i], vmstats_get(i));
+    }
+    for (unsigned i = 0; i < VMLAT_COUNT; i++)
+    {
+        vmstats_getlat(i, &vl);
+        kprintf("latency_%s_count=%u\n", vmlat_keys[i], vl.vl_count);
+        kprintf("latency_%s_mean=%llu\n", vmlat_keys[i], vl.vl_mean);
+        kprintf("latency_%s_p50=%llu\n", vmlat_keys[i], vl.vl_p50);
+        kprintf("latency_%s_p99=%llu\n", vmlat_keys[i], vl.vl_p99);
+        kprintf("latency_%s_max=%llu\n", vmlat_keys[i], vl.vl_max);
+    }
+    kprintf("vmstats end\n");
+}
@@ -0,0 +1,196 @@
+/*
+ * VM event trace. See vmtrace.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <membar.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <timer.h>
+#include <lamebus/ltrace.h>
+#include <vmtrace.h>
+
+/* sys161 has at most 32 cpus */
+#define VMTRACE_MAXCPUS 32
+
+/* events per cpu: 4096 * 24 bytes, 24 pages each */
+#define VMTRACE_NEVENTS 4096
+
+struct vmtrace_ring {
+	struct vmtrace_event *vr_events;
+	uint32_t vr_next;		/* events written so far */
+};
+
+volatile bool vmtrace_on;
+static bool vmtrace_ltrace;
+
+/*
+ * The rings are allocated the first time the trace is turned on and
+ * never freed, so a cpu that saw vmtrace_on just before it was turned
+ * off can still safely finish writing its event.
+ */
+static struct vmtrace_ring vmtrace_rings[VMTRACE_MAXCPUS];
+static unsigned vmtrace_ncpus;
+
+void
+vmtrace_log(unsigned type, unsigned aux, struct addrspace *as,
+	    uint32_t a, uint32_t b)
+{
+	struct vmtrace_ring *vr;
+	struct vmtrace_event *ve;
+	uint64_t now;
+	int spl;
+
+	now = timer_now();
+
+	/* stay on this cpu, and keep interrupt handlers off the ring */
+	spl = splhigh();
+	if (!CURCPU_EXISTS() || curcpu->c_number >= vmtrace_ncpus) {
+		splx(spl);
+		return;
+	}
+	vr = &vmtrace_rings[curcpu->c_number];
+	ve = &vr->vr_events[vr->vr_next % VMTRACE_NEVENTS];
+	ve->ve_time = now;
+	ve->ve_a = a;
+	ve->ve_b = b;
+	ve->ve_as = (uint32_t)as;
+	ve->ve_type = type;
+	ve->ve_aux = aux;
+	ve->ve_cpu = curcpu->c_number;
+	ve->ve_pad = 0;
+	vr->vr_next++;
+	splx(spl);
+
+	if (vmtrace_ltrace) {
+		ltrace_debug((type << 24) | ((a >> 12) & 0xffffff));
+	}
+}
+
+int
+vmtrace_start(bool ltrace)
+{
+	unsigned i, ncpus;
+
+	if (vmtrace_on) {
+		return 0;
+	}
+
+	ncpus = cpu_count();
+	if (ncpus > VMTRACE_MAXCPUS) {
+		ncpus = VMTRACE_MAXCPUS;
+	}
+	for (i=0; i<ncpus; i++) {
+		if (vmtrace_rings[i].vr_events == NULL) {
+			vmtrace_rings[i].vr_events = kmalloc(VMTRACE_NEVENTS *
+					sizeof(struct vmtrace_event));
+			if (vmtrace_rings[i].vr_events == NULL) {
+				return ENOMEM;
+			}
+		}
+		vmtrace_rings[i].vr_next = 0;
+	}
+	vmtrace_ncpus = ncpus;
+	vmtrace_ltrace = ltrace;
+
+	membar_store_store();
+	vmtrace_on = true;
+	return 0;
+}
+
+void
+vmtrace_stop(void)
+{
+	vmtrace_on = false;
+}
+
+/*
+ * Write LEN bytes at *POS in the file V.
+ */
+static
+int
+vmtrace_write(struct vnode *v, off_t *pos, void *buf, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(v, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*pos += len;
+	return 0;
+}
+
+int
+vmtrace_save(const char *path)
+{
+	struct vmtrace_header vh;
+	struct vmtrace_ring *vr;
+	struct vnode *v;
+	char *name;
+	off_t pos;
+	uint32_t count, first, n;
+	unsigned i;
+	bool wason;
+	int result;
+
+	/* vfs_open destroys the string it's passed */
+	name = kstrdup(path);
+	if (name == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(name, O_WRONLY | O_CREAT | O_TRUNC, 0664, &v);
+	kfree(name);
+	if (result) {
+		return result;
+	}
+
+	/* hold the rings still while writing them out */
+	wason = vmtrace_on;
+	vmtrace_on = false;
+
+	vh.vh_magic = VMTRACE_MAGIC;
+	vh.vh_version = VMTRACE_VERSION;
+	vh.vh_ncpus = vmtrace_ncpus;
+	vh.vh_eventsize = sizeof(struct vmtrace_event);
+	pos = 0;
+	result = vmtrace_write(v, &pos, &vh, sizeof(vh));
+
+	for (i=0; i<vmtrace_ncpus && !result; i++) {
+		vr = &vmtrace_rings[i];
+		count = vr->vr_next < VMTRACE_NEVENTS ?
+			vr->vr_next : VMTRACE_NEVENTS;
+		result = vmtrace_write(v, &pos, &count, sizeof(count));
+		if (result) {
+			break;
+		}
+
+		/* oldest first: from vr_next round to the end, then the rest */
+		first = (vr->vr_next - count) % VMTRACE_NEVENTS;
+		n = count < VMTRACE_NEVENTS - first ?
+			count : VMTRACE_NEVENTS - first;
+		result = vmtrace_write(v, &pos, &vr->vr_events[first],
+				       n * sizeof(struct vmtrace_event));
+		if (!result && n < count) {
+			result = vmtrace_write(v, &pos, &vr->vr_events[0],
+				(count - n) * sizeof(struct vmtrace_event));
+		}
+	}
+
+	vmtrace_on = wason;
+	vfs_close(v);
+	return result;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* matmult.c
+ *    Test program to do matrix multiplication on large arrays.
+ *
+ *    Parallel version of hugematmult1: the rows of the result are
+ *    split among NTHREADS user threads sharing the address space.
+ *    Run it with at least NTHREADS cpus in sys161.conf to see it
+ *    scale; the elapsed time of the multiplication is printed, with
+ *    the user and system time of the process.
+ *
+ *    Intended to stress virtual memory system with concurrent faults
+ *    from several CPUs on the same address space.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <kern/resource.h>
+
+/* system calls without a libc prototype (stubs generated from kern/syscall.h) */
+int thread_create(void (*func)(void *), void *arg);
+int thread_join(int tid);
+void thread_exit(void);
+int getrusage(int who, struct rusage *usage);
+
+#define NTHREADS 4
+
+#define Dim 	133	/* sum total of the arrays doesn't fit in
+			 * physical memory
+			 */
+
+#define RIGHT  103126870		/* correct answer */
+
+int A[Dim][Dim];
+int B[Dim][Dim];
+int C[Dim][Dim];
+int T[Dim][Dim][Dim];
+
+/*
+ * Compute the rows of C assigned to thread id.
+ */
+static
+void
+multiply(int id)
+{
+    int i, j, k;
+
+    for (i = id; i < Dim; i += NTHREADS)
+	for (j = 0; j < Dim; j++)
+            for (k = 0; k < Dim; k++)
+		T[i][j][k] = A[i][k] * B[k][j];
+
+    for (i = id; i < Dim; i += NTHREADS)
+	for (j = 0; j < Dim; j++)
+            for (k = 0; k < Dim; k++)
+		C[i][j] += T[i][j][k];
+}
+
+static
+void
+worker(void *arg)
+{
+    multiply((int)arg);
+    thread_exit();
+}
+
+int
+main(void)
+{
+    int i, j, r;
+    int tids[NTHREADS];
+    struct rusage ru;
+    time_t s0, s1;
+    unsigned long ns0, ns1, ms;
+
+    for (i = 0; i < Dim; i++)		/* first initialize the matrices */
+	for (j = 0; j < Dim; j++) {
+	     A[i][j] = i;
+	     B[i][j] = j;
+	     C[i][j] = 0;
+	}
+
+    __time(&s0, &ns0);
+    for (i = 1; i < NTHREADS; i++) {	/* then multiply them together */
+	tids[i] = thread_create(worker, (void *)i);
+	if (tids[i] < 0) {
+	    printf("thread_create failed\n");
+	    return 1;
+	}
+    }
+    multiply(0);
+    for (i = 1; i < NTHREADS; i++) {
+	thread_join(tids[i]);
+    }
+    __time(&s1, &ns1);
+
+    r = 0;
+    for (i = 0; i < Dim; i++)
+	    r += C[i][i];
+
+    ms = (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+    printf("matmult finished with %d threads in %lu ms.\n", NTHREADS, ms);
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+	printf("cpu time: %lu ms user, %lu ms system\n",
+	       (unsigned long)ru.ru_utime.tv_sec * 1000
+	       + ru.ru_utime.tv_usec / 1000,
+	       (unsigned long)ru.ru_stime.tv_sec * 1000
+	       + ru.ru_stime.tv_usec / 1000);
+    }
+    printf("answer is: %d (should be %d)\n", r, RIGHT);
+    if (r != RIGHT) {
+	    printf("FAILED\n");
+	    return 1;
+    }
+    printf("Passed.\n");
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * iovtest.c
+ *
+ *    Checks readv/writev with several small buffers in the same page.
+ *    The kernel pins the page of every buffer of a batch before the
+ *    transfer, so the same page gets pinned more than once.
+ *
+ *    A record is written with writev from four buffers, two of them in
+ *    one page and two in the next, then read back with readv into
+ *    another such set of buffers and compared.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+#include <kern/iovec.h>
+
+/* not in the libc headers; the stubs come from kern/syscall.h */
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt);
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt);
+
+#define FILENAME	"iovtest.dat"
+#define PAGESIZE	4096
+#define NBUFS		4
+#define BUFLEN		100
+
+/* room for two page-aligned pages, for the writes and for the reads */
+static char wspace[3*PAGESIZE];
+static char rspace[3*PAGESIZE];
+
+/*
+ * Set up IOV with two buffers at the start of the first page in AREA
+ * and two at the start of the second.
+ */
+static
+void
+setup(struct iovec *iov, char *area)
+{
+	char *page;
+	int i;
+
+	page = (char *)(((unsigned long)area + PAGESIZE - 1) &
+			~(unsigned long)(PAGESIZE - 1));
+	for (i = 0; i < NBUFS; i++) {
+		iov[i].iov_base = page + (i / 2) * PAGESIZE + (i % 2) * 2 * BUFLEN;
+		iov[i].iov_len = BUFLEN;
+	}
+}
+
+int
+main(void)
+{
+	struct iovec wiov[NBUFS], riov[NBUFS];
+	int fd, i, j;
+	ssize_t r;
+
+	setup(wiov, wspace);
+	setup(riov, rspace);
+	for (i = 0; i < NBUFS; i++) {
+		for (j = 0; j < BUFLEN; j++) {
+			((char *)wiov[i].iov_base)[j] = (char)(i * BUFLEN + j);
+		}
+	}
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", FILENAME);
+	}
+	r = writev(fd, wiov, NBUFS);
+	if (r < 0) {
+		err(1, "%s: writev", FILENAME);
+	}
+	if (r != NBUFS * BUFLEN) {
+		errx(1, "%s: short writev: %ld bytes", FILENAME, (long)r);
+	}
+	close(fd);
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", FILENAME);
+	}
+	r = readv(fd, riov, NBUFS);
+	if (r < 0) {
+		err(1, "%s: readv", FILENAME);
+	}
+	if (r != NBUFS * BUFLEN) {
+		errx(1, "%s: short readv: %ld bytes", FILENAME, (long)r);
+	}
+	close(fd);
+
+	for (i = 0; i < NBUFS; i++) {
+		if (memcmp(riov[i].iov_base, wiov[i].iov_base, BUFLEN)) {
+			errx(1, "buffer %d: data mismatch", i);
+		}
+	}
+
+	remove(FILENAME);
+	printf("iovtest: passed\n");
+	return 0;
+}
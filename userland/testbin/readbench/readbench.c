@@ -0,0 +1,92 @@
+/*
+ * readbench.c
+ *
+ *    Measures the throughput of read() from a file into a user buffer.
+ *    A 16 MB file is written first, then read back in BUFSIZE chunks
+ *    and the elapsed time is reported in MB/s.
+ *
+ *    The read buffer is much larger than a page, so that the kernel
+ *    has to fault in and pin several user pages for every call.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <err.h>
+
+#define FILENAME	"readbench.dat"
+#define FILESIZE	(16*1024*1024)
+#define BUFSIZE		(64*1024)
+
+static char buf[BUFSIZE];
+
+/*
+ * Elapsed time in milliseconds.
+ */
+static
+unsigned long
+elapsed_ms(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+}
+
+int
+main(void)
+{
+	int fd, i;
+	int done, r;
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+
+	for (i = 0; i < BUFSIZE; i++) {
+		buf[i] = (char)i;
+	}
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", FILENAME);
+	}
+	for (done = 0; done < FILESIZE; done += r) {
+		r = write(fd, buf, BUFSIZE);
+		if (r <= 0) {
+			err(1, "%s: write", FILENAME);
+		}
+	}
+	close(fd);
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", FILENAME);
+	}
+
+	__time(&s0, &ns0);
+	for (done = 0; done < FILESIZE; done += r) {
+		r = read(fd, buf, BUFSIZE);
+		if (r < 0) {
+			err(1, "%s: read", FILENAME);
+		}
+		if (r == 0) {
+			errx(1, "%s: unexpected EOF after %d bytes",
+			     FILENAME, done);
+		}
+	}
+	__time(&s1, &ns1);
+	close(fd);
+
+	/* check the tail of the last chunk */
+	for (i = 0; i < BUFSIZE; i++) {
+		if (buf[i] != (char)i) {
+			errx(1, "%s: data mismatch at offset %d", FILENAME,
+			     FILESIZE - BUFSIZE + i);
+		}
+	}
+
+	ms = elapsed_ms(s0, ns0, s1, ns1);
+	if (ms == 0) {
+		ms = 1;
+	}
+	printf("readbench: read %d bytes in %lu ms, %lu.%02lu MB/s\n",
+	       FILESIZE, ms, (16UL * 1000) / ms,
+	       ((16UL * 100000) / ms) % 100);
+	return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * syscallbench.c
+ *
+ *    Measures the per-call overhead of a few cheap system calls:
+ *
+ *      - write() on a bad file descriptor, which traps into the kernel
+ *        and fails right away without touching user memory;
+ *      - __time() asking for no result, one, and both. It copies the
+ *        results out with copyoutv, all in one protected section.
+ *
+ *    The same syscall is timed each way, so the differences isolate
+ *    the copies:
+ *
+ *      one region - none:  a whole protected copy, setup included;
+ *      two regions - one:  one more region within the same section.
+ *
+ *    What the first costs more than the second is the per-call setup
+ *    that the vectored copy pays once instead of once per region.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#define NCALLS	20000
+
+/* 64 bits: a 32-bit count of ns wraps after about 4.3 seconds */
+static
+unsigned long long
+elapsed_ns(time_t s0, unsigned long ns0, time_t s1, unsigned long ns1)
+{
+	return (unsigned long long)(s1 - s0) * 1000000000ULL + ns1 - ns0;
+}
+
+/*
+ * Time NCALLS calls of __time with the given result pointers; return
+ * the ns per call.
+ */
+static
+unsigned long long
+time_calls(time_t *secs, unsigned long *nsecs)
+{
+	int i;
+	time_t s0, s1;
+	unsigned long ns0, ns1;
+
+	__time(&s0, &ns0);
+	for (i = 0; i < NCALLS; i++) {
+		__time(secs, nsecs);
+	}
+	__time(&s1, &ns1);
+	return elapsed_ns(s0, ns0, s1, ns1) / NCALLS;
+}
+
+int
+main(void)
+{
+	int i;
+	time_t s0, s1, s;
+	unsigned long ns0, ns1, ns;
+	unsigned long long tot, none, one, two;
+
+	__time(&s0, &ns0);
+	for (i = 0; i < NCALLS; i++) {
+		write(-1, NULL, 0);
+	}
+	__time(&s1, &ns1);
+	tot = elapsed_ns(s0, ns0, s1, ns1);
+	printf("syscallbench: null syscall: %llu ns/call\n", tot / NCALLS);
+
+	none = time_calls(NULL, NULL);
+	one = time_calls(&s, NULL);
+	two = time_calls(&s, &ns);
+	printf("syscallbench: __time, no region: %llu ns/call\n", none);
+	printf("syscallbench: __time, 1 region: %llu ns/call\n", one);
+	printf("syscallbench: __time, 2 regions: %llu ns/call\n", two);
+	printf("syscallbench: protected copy: %lld ns, "
+	       "extra region in it: %lld ns\n",
+	       (long long)(one - none), (long long)(two - one));
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * vmbrand.c
+ *
+ *    VM benchmark: random access. Bumps one word in a random page of
+ *    an NPAGES-page array, NTOUCHES times. The pages come from a fixed
+ *    linear congruential sequence, so every run touches the same pages
+ *    in the same order. Several copies at once ("pn 3 testbin/vmbrand"
+ *    from the menu) make the multi-process workload; each of them
+ *    prints its vmbench line with a single write, so the lines of the
+ *    copies don't get mixed up on the console.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_INTS	(4096 / sizeof(int))
+#define NPAGES		512		/* 2 MB */
+#define NTOUCHES	100000
+
+static int data[NPAGES * PAGE_INTS];
+
+int
+main(void)
+{
+	unsigned i, seed, sum;
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+	char line[128];
+
+	seed = 1;
+	__time(&s0, &ns0);
+	for (i = 0; i < NTOUCHES; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[(seed >> 8) % (NPAGES * PAGE_INTS)]++;
+	}
+	__time(&s1, &ns1);
+
+	sum = 0;
+	for (i = 0; i < NPAGES * PAGE_INTS; i++) {
+		sum += data[i];
+	}
+	if (sum != NTOUCHES) {
+		errx(1, "sum is %u, should be %u", sum, NTOUCHES);
+	}
+
+	ms = (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	printf("vmbrand: %u random touches over %u pages in %lu ms\n",
+	       NTOUCHES, NPAGES, ms);
+	snprintf(line, sizeof(line),
+		 "vmbench name=rand pages=%u touches=%u ms=%lu\n",
+		 NPAGES, NTOUCHES, ms);
+	write(STDOUT_FILENO, line, strlen(line));
+	return 0;
+}
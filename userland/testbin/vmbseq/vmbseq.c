@@ -0,0 +1,50 @@
+/*
+ * vmbseq.c
+ *
+ *    VM benchmark: sequential scan. Walks an array of NPAGES pages
+ *    from start to end PASSES times, checking and rewriting every
+ *    word. With the array smaller than RAM, after the first pass this
+ *    measures TLB refills only.
+ *
+ *    Like the other vmb* programs, it ends with a line of key=value
+ *    pairs starting with "vmbench", for vmbench.py.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_INTS	(4096 / sizeof(int))
+#define NPAGES		512		/* 2 MB */
+#define PASSES		4
+
+static int data[NPAGES * PAGE_INTS];
+
+int
+main(void)
+{
+	unsigned i, pass;
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+
+	__time(&s0, &ns0);
+	for (i = 0; i < NPAGES * PAGE_INTS; i++) {
+		data[i] = i;
+	}
+	for (pass = 1; pass < PASSES; pass++) {
+		for (i = 0; i < NPAGES * PAGE_INTS; i++) {
+			if (data[i] != (int)(i + pass - 1)) {
+				errx(1, "pass %u: bad value at %u", pass, i);
+			}
+			data[i] = i + pass;
+		}
+	}
+	__time(&s1, &ns1);
+
+	ms = (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	printf("vmbseq: %u passes over %u pages in %lu ms\n",
+	       PASSES, NPAGES, ms);
+	printf("vmbench name=seq pages=%u passes=%u ms=%lu\n",
+	       NPAGES, PASSES, ms);
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * vmbstride.c
+ *
+ *    VM benchmark: strided matrix access. Fills a DIM x DIM matrix by
+ *    rows, then adds it up by columns PASSES times, so that
+ *    consecutive accesses are a row (2 KB) apart and each column walk
+ *    touches more pages than the TLB can map.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define DIM		512		/* 1 MB */
+#define PASSES		4
+
+static int m[DIM][DIM];
+
+int
+main(void)
+{
+	unsigned i, j, pass, sum, expected;
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+
+	__time(&s0, &ns0);
+	for (i = 0; i < DIM; i++) {
+		for (j = 0; j < DIM; j++) {
+			m[i][j] = i + j;
+		}
+	}
+	sum = 0;
+	for (pass = 0; pass < PASSES; pass++) {
+		for (j = 0; j < DIM; j++) {
+			for (i = 0; i < DIM; i++) {
+				sum += m[i][j];
+			}
+		}
+	}
+	__time(&s1, &ns1);
+
+	/* each of i and j goes through 0..DIM-1 DIM times */
+	expected = PASSES * 2 * DIM * (DIM * (DIM - 1) / 2);
+	if (sum != expected) {
+		errx(1, "sum is %u, should be %u", sum, expected);
+	}
+
+	ms = (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	printf("vmbstride: %u column passes over %ux%u in %lu ms\n",
+	       PASSES, DIM, DIM, ms);
+	printf("vmbench name=stride dim=%u passes=%u ms=%lu\n",
+	       DIM, PASSES, ms);
+	return 0;
+}
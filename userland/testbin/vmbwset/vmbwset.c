@@ -0,0 +1,46 @@
+/*
+ * vmbwset.c
+ *
+ *    VM benchmark: working set larger than RAM. Walks an array of
+ *    NPAGES pages (6 MB, more than the RAM of the usual configs but
+ *    less than the 9 MB swap file) PASSES times, touching one word
+ *    per STEP, so that nearly every page has to come back from swap
+ *    on each pass.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define PAGE_INTS	(4096 / sizeof(int))
+#define NPAGES		1536		/* 6 MB */
+#define PASSES		3
+#define STEP		256		/* ints: four touches per page */
+
+static int data[NPAGES * PAGE_INTS];
+
+int
+main(void)
+{
+	unsigned i, pass;
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms;
+
+	__time(&s0, &ns0);
+	for (pass = 0; pass < PASSES; pass++) {
+		for (i = 0; i < NPAGES * PAGE_INTS; i += STEP) {
+			if (data[i] != (int)(pass == 0 ? 0 : i + pass - 1)) {
+				errx(1, "pass %u: bad value at %u", pass, i);
+			}
+			data[i] = i + pass;
+		}
+	}
+	__time(&s1, &ns1);
+
+	ms = (unsigned long)(s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	printf("vmbwset: %u passes over %u pages in %lu ms\n",
+	       PASSES, NPAGES, ms);
+	printf("vmbench name=wset pages=%u passes=%u ms=%lu\n",
+	       NPAGES, PASSES, ms);
+	return 0;
+}
@@ -0,0 +1,212 @@
+#!/usr/bin/env python3
+#
+# VM benchmark harness. Runs the vmb* workloads of userland/testbin
+# under each kernel config and RAM size, one fresh sys161 per run, and
+# writes a CSV and a JSON report with, for each run:
+#   - the simulated cycles, from the sys161 shutdown summary
+#   - the time the workload reported itself (max over its processes)
+#   - the VM counters and fault latencies of the "vms" dump, including
+#     swap I/O (page_faults_swap reads, swap_writes)
+#
+# The kernels are expected as kernel-<CONFIG> in the root directory,
+# which is where "bmake install" of each config puts them.
+#
+# Under a config without "options swap" the workloads that don't fit in
+# RAM can only panic, so they are skipped and reported as such.
+#
+#   vmbench.py                       everything
+#   vmbench.py -c RUDEVM -r 512K -w wset -w multi
+
+import argparse
+import csv
+import json
+import os
+import re
+import shutil
+import time
+
+import pexpect
+
+from execute_tests import getprompt, parse_vmstats
+
+PROMPT = "OS/161 kernel [? for menu]: "
+
+CONFIGS = ["RUDEVM", "RUDEVM-NORDONLY", "RUDEVM-NOSWAP"]
+RAM_SIZES = ["512K", "1M", "4M"]
+
+# name, menu command, memory the workload touches in KB
+WORKLOADS = [
+    ("seq", "p testbin/vmbseq", 2048),
+    ("rand", "p testbin/vmbrand", 2048),
+    ("stride", "p testbin/vmbstride", 1024),
+    ("wset", "p testbin/vmbwset", 6144),
+    ("multi", "pn 3 testbin/vmbrand", 3 * 2048),
+]
+
+# VM counters in the report, in this order; all the others of the
+# "vms" dump (the latencies) follow them
+COUNTERS = [
+    "tlb_faults",
+    "tlb_reloads",
+    "page_faults_zeroed",
+    "page_faults_elf",
+    "page_faults_swap",
+    "swap_writes",
+]
+
+
+def ram_kb(ram):
+    units = {"K": 1, "M": 1024}
+    return int(ram[:-1]) * units[ram[-1].upper()]
+
+
+def has_swap(config):
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        "kern", "conf", config)
+    try:
+        with open(path) as f:
+            return any(re.match(r"options\s+swap\b", line) for line in f)
+    except OSError:
+        # can't tell: assume it has
+        return True
+
+
+def set_ramsize(root, ram):
+    conf = os.path.join(root, "sys161.conf")
+    backup = conf + ".backup"
+    if not os.path.exists(backup):
+        shutil.copyfile(conf, backup)
+
+    with open(backup) as f:
+        text = f.read()
+    with open(conf, "w") as f:
+        f.write(re.sub(r"ramsize=\S+", "ramsize=" + ram, text))
+
+
+def restore_conf(root):
+    conf = os.path.join(root, "sys161.conf")
+    backup = conf + ".backup"
+    if os.path.exists(backup):
+        shutil.copyfile(backup, conf)
+
+
+def run_one(root, config, command, timeout):
+    result = {"status": "ok"}
+
+    proc = pexpect.spawn("sys161", ["kernel-" + config], cwd=root,
+                         encoding="utf-8", timeout=timeout)
+    proc.delaybeforesend = None
+    try:
+        msg = getprompt(proc, PROMPT, timeout)
+        if msg:
+            result["status"] = "boot: " + msg
+            return result
+
+        proc.sendline(command)
+        msg = getprompt(proc, PROMPT, timeout)
+        if msg:
+            result["status"] = msg
+            return result
+        output = proc.before
+
+        # with several processes the console output can interleave, so
+        # look for the records anywhere, not just at the start of lines
+        lines = re.findall(r"vmbench name=\S+(?: \w+=\d+)*", output)
+        statuses = re.findall(r"exit status of (?:the )?process(?: \d+)?: "
+                              r"(-?\d+)", output)
+        if not lines or len(lines) != len(statuses) or \
+           any(s != "0" for s in statuses):
+            result["status"] = "failed"
+        times = []
+        for line in lines:
+            fields = dict(f.split("=", 1) for f in line.split()[1:])
+            if "ms" in fields:
+                times.append(int(fields["ms"]))
+        result["ms"] = max(times) if times else ""
+
+        proc.sendline("vms")
+        msg = getprompt(proc, PROMPT, timeout)
+        if msg:
+            result["status"] = msg
+            return result
+        result.update(parse_vmstats(proc.before))
+
+        proc.sendline("q")
+        proc.expect(pexpect.EOF)
+        m = re.search(r"sys161: (\d+) cycles", proc.before)
+        result["cycles"] = int(m.group(1)) if m else ""
+    finally:
+        proc.close(force=True)
+
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the VM benchmarks")
+    parser.add_argument("-c", "--config", action="append",
+                        help="kernel config (default: all of %s)"
+                        % ", ".join(CONFIGS))
+    parser.add_argument("-r", "--ram", action="append",
+                        help="RAM size (default: all of %s)"
+                        % ", ".join(RAM_SIZES))
+    parser.add_argument("-w", "--workload", action="append",
+                        choices=[w[0] for w in WORKLOADS],
+                        help="workload (default: all)")
+    parser.add_argument("--root", default=os.path.join(
+                        os.getenv("HOME", ""), "os161", "root"),
+                        help="directory with the kernels and sys161.conf")
+    parser.add_argument("--timeout", type=int, default=600,
+                        help="seconds allowed for each step of a run")
+    parser.add_argument("--csv", default="vmbench.csv")
+    parser.add_argument("--json", default="vmbench.json")
+    args = parser.parse_args()
+
+    configs = args.config or CONFIGS
+    rams = args.ram or RAM_SIZES
+    workloads = [w for w in WORKLOADS
+                 if not args.workload or w[0] in args.workload]
+
+    runs = []
+    try:
+        for config in configs:
+            swap = has_swap(config)
+            for ram in rams:
+                set_ramsize(args.root, ram)
+                for name, command, kb in workloads:
+                    print(f"{config} {ram} {name}: ", end="", flush=True)
+                    if not swap and kb >= ram_kb(ram):
+                        result = {"status": "skipped: needs swap"}
+                    else:
+                        result = run_one(args.root, config, command,
+                                         args.timeout)
+                    print(result["status"], result.get("cycles", ""))
+                    runs.append(dict(config=config, ram=ram, workload=name,
+                                     **result))
+    finally:
+        restore_conf(args.root)
+
+    columns = ["config", "ram", "workload", "status", "cycles", "ms"]
+    columns += COUNTERS
+    for run in runs:
+        for key in run:
+            if key not in columns:
+                columns.append(key)
+
+    with open(args.csv, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=columns, restval="")
+        writer.writeheader()
+        writer.writerows(runs)
+
+    with open(args.json, "w") as f:
+        json.dump({"date": time.strftime("%Y-%m-%d %H:%M:%S"),
+                   "runs": runs}, f, indent=2)
+
+    skipped = [r for r in runs if r["status"].startswith("skipped")]
+    failed = [r for r in runs
+              if r["status"] != "ok" and r not in skipped]
+    print(f"\n{len(runs)} runs, {len(failed)} failed, "
+          f"{len(skipped)} skipped; report in {args.csv} and {args.json}")
+
+
+if __name__ == '__main__':
+    main()
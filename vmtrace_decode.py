@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+#
+# Decoder for the VM event trace saved by the kernel's "vmtrace save"
+# command (see kern/include/vmtrace.h).
+#
+#   vmtrace_decode.py vmtrace.bin             timeline of all events
+#   vmtrace_decode.py --wss 10 vmtrace.bin    working set per 10 ms, CSV
+#
+# The working set of an address space in a window is the number of
+# distinct user pages it faulted on in that window: with a software
+# TLB every page that is touched after falling out of the TLB faults,
+# so this is a lower bound that gets closer the smaller the TLB is
+# compared to the working set.
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x564d5452
+HEADER = struct.Struct(">IIII")
+COUNT = struct.Struct(">I")
+EVENT = struct.Struct(">QIIIBBBB")
+
+FAULT, RESOLVE, SWAPIN, EVICT, TLB, TLBFLUSH = range(1, 7)
+
+FAULT_TYPES = {0: "read", 1: "write", 2: "readonly"}
+PATHS = {0: "zero-fill", 1: "elf", 2: "swap-in", 3: "reload", 4: "retry"}
+PAGE_SIZE = 4096
+USERSPACETOP = 0x80000000
+
+
+def read_trace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, ncpus, eventsize = HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        sys.exit(f"{path}: not a vmtrace file")
+    if version != 1 or eventsize != EVENT.size:
+        sys.exit(f"{path}: unsupported version {version}")
+
+    events = []
+    pos = HEADER.size
+    for _ in range(ncpus):
+        (count,) = COUNT.unpack_from(data, pos)
+        pos += COUNT.size
+        for _ in range(count):
+            events.append(EVENT.unpack_from(data, pos))
+            pos += EVENT.size
+
+    # each ring is in order; merge them by time
+    events.sort(key=lambda e: e[0])
+    return events
+
+
+def describe(event):
+    _, a, b, _, etype, aux, _, _ = event
+    if etype == FAULT:
+        return f"fault    0x{a:08x} {FAULT_TYPES.get(aux, aux)}"
+    if etype == RESOLVE:
+        return f"resolve  0x{a:08x} -> 0x{b:08x} {PATHS.get(aux, aux)}"
+    if etype == SWAPIN:
+        return f"swapin   slot {a} -> 0x{b:08x}"
+    if etype == EVICT:
+        if aux == 1:
+            return f"evict    0x{a:08x} dropped (read-only)"
+        return f"evict    0x{a:08x} -> slot {b}"
+    if etype == TLB:
+        replaced = " replaced" if aux & 0x80 else ""
+        return f"tlb      0x{a:08x} -> 0x{b:08x} slot {aux & 0x7f}{replaced}"
+    if etype == TLBFLUSH:
+        return "tlbflush"
+    return f"type {etype} a=0x{a:08x} b=0x{b:08x} aux={aux}"
+
+
+def timeline(events):
+    if not events:
+        return
+    start = events[0][0]
+    for event in events:
+        time, _, _, asid, _, _, cpu, _ = event
+        print(f"{(time - start) / 1000:12.1f} us  cpu{cpu}  "
+              f"as 0x{asid:08x}  {describe(event)}")
+
+
+def working_set(events, window_ms):
+    if not events:
+        return
+    window = int(window_ms * 1000000)
+    start = events[0][0]
+
+    pages = {}  # (window, as) -> set of pages
+    for time, a, _, asid, etype, _, _, _ in events:
+        if etype == FAULT and a < USERSPACETOP:
+            key = ((time - start) // window, asid)
+            pages.setdefault(key, set()).add(a // PAGE_SIZE)
+
+    print("window_ms,as,pages")
+    for (w, asid), p in sorted(pages.items()):
+        print(f"{w * window_ms},0x{asid:08x},{len(p)}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a vmtrace file")
+    parser.add_argument("--wss", type=float, metavar="MS",
+                        help="print the working set per MS ms window, as CSV")
+    parser.add_argument("file")
+    args = parser.parse_args()
+
+    events = read_trace(args.file)
+    if args.wss:
+        working_set(events, args.wss)
+    else:
+        timeline(events)
+
+
+if __name__ == '__main__':
+    main()